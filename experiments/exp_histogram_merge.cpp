@@ -0,0 +1,207 @@
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <stdexcept>
+
+#include <meow/stopwatch.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/histogram.h"
+#include "pinba/multi_merge.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// compare histogram merge strategies for many packed histograms (see histogram___flat_merge_packed)
+//  - pairwise in place merges of unpacked values (what rollups did before)
+//  - k-way merge with binary heap (stdlib), linear scan of heads (small) and loser tree
+//  - dense accumulation
+//  - adaptive choice (what rollups use, with unpack)
+// inputs look like time histograms of a row: log-normal, centered at ~20ms, 'busy' and 'sparse' rows
+//  - busy: 1000 values per histogram, 1ms buckets, all histograms hit the same ~1k bucket ids
+//  - sparse: 20 values per histogram, spread over a wide range of bucket ids, i.e. little overlap
+//
+// NOTE: experiments are built with -O0 by default, this one is built with -O3 (see Makefile.am)
+
+static constexpr uint32_t n_rounds = 200;
+
+struct input_t
+{
+	packed_histogram_arena_t             arena;
+	std::vector<packed_histogram_ref_t>  refs;
+	std::vector<histogram_values_t>      values; // decoded, for strategies that take values directly
+	size_t                               n_values;
+	uint32_t                             min_id;
+	uint32_t                             max_id;
+};
+
+static void generate_input(input_t *in, uint32_t n_hvs, uint32_t values_per_hv, uint32_t bucket_count, double sigma)
+{
+	std::mt19937 rng(n_hvs * bucket_count);
+	std::lognormal_distribution<double> dist(std::log(20.0), sigma);
+
+	in->n_values = 0;
+	in->min_id   = UINT32_MAX;
+	in->max_id   = 0;
+
+	std::vector<packed_histogram_t> packed;
+
+	for (uint32_t i = 0; i < n_hvs; i++)
+	{
+		flat_histogram_t hv = {};
+
+		std::vector<uint32_t> counts(bucket_count, 0);
+		for (uint32_t j = 0; j < values_per_hv; j++)
+		{
+			uint32_t const bucket_id = std::min<uint32_t>(dist(rng), bucket_count - 1);
+			counts[bucket_id]++;
+		}
+
+		for (uint32_t bucket_id = 0; bucket_id < bucket_count; bucket_id++)
+		{
+			if (counts[bucket_id] == 0)
+				continue;
+
+			hv.values.push_back({ .bucket_id = bucket_id, .value = counts[bucket_id] });
+			hv.total_count += counts[bucket_id];
+		}
+
+		in->n_values += hv.values.size();
+		in->min_id    = std::min(in->min_id, hv.values.front().bucket_id);
+		in->max_id    = std::max(in->max_id, hv.values.back().bucket_id);
+
+		packed.push_back(histogram___pack_flat(&in->arena, hv));
+		in->values.push_back(std::move(hv.values));
+	}
+
+	// arena might have been reallocated while packing, take refs at the end
+	for (auto const& p : packed)
+		in->refs.push_back({ .arena = &in->arena, .hv = p });
+}
+
+// same as histogram___merge_values___multi_merge(), with explicit k-way merge strategy
+template<class MergeFunction>
+static void merge_values_with(histogram_values_t *to, input_t const& in, MergeFunction const& merge_func)
+{
+	struct merger_t
+	{
+		histogram_values_t *values;
+
+		void reserve(size_t) {}
+
+		void push_back(histogram_values_t const*, histogram_value_t const& v)
+		{
+			if (!values->empty() && (values->back().bucket_id == v.bucket_id))
+				values->back().value += v.value;
+			else
+				values->push_back(v);
+		}
+
+		bool compare(histogram_value_t const& l, histogram_value_t const& r) const
+		{
+			return l.bucket_id < r.bucket_id;
+		}
+	};
+
+	std::vector<histogram_values_t const*> sequences;
+	for (auto const& v : in.values)
+		sequences.push_back(&v);
+
+	merger_t merger = { .values = to };
+	merge_func(&merger, sequences.begin(), sequences.end());
+}
+
+template<class Function>
+static double run(Function const& func)
+{
+	meow::stopwatch_t sw;
+
+	for (uint32_t i = 0; i < n_rounds; i++)
+		func();
+
+	return timeval_to_double(sw.stamp()) / n_rounds;
+}
+
+int main(int argc, char const *argv[])
+try
+{
+	struct shape_t
+	{
+		char const *name;
+		uint32_t    values_per_hv;
+		uint32_t    bucket_count;
+		double      sigma;
+	};
+
+	shape_t const shapes[] = {
+		{ "busy",   1000, 1000,        1.0 },
+		{ "busy",   1000, 100 * 1000,  1.0 },
+		{ "sparse", 20,   100 * 1000,  2.5 },
+		{ "sparse", 20,   1000 * 1000, 4.0 },
+	};
+
+	using sequence_t = std::vector<histogram_values_t const*>::iterator;
+
+	for (auto const& shape : shapes)
+	for (uint32_t const n_hvs : { 2, 4, 8, 16, 32, 60, 120, 240 })
+	{
+		input_t in;
+		generate_input(&in, n_hvs, shape.values_per_hv, shape.bucket_count, shape.sigma);
+
+		flat_histogram_t hv;
+
+		double const pairwise_d = run([&]()
+		{
+			hv.values.clear();
+			for (auto const& values : in.values)
+				histogram___flat_add_values(&hv.values, values);
+		});
+
+		double const heap_d = run([&]()
+		{
+			hv.values.clear();
+			merge_values_with(&hv.values, in, [](auto *m, sequence_t b, sequence_t e) { pinba::multi_merge__stdlib(m, b, e); });
+		});
+
+		double const small_d = run([&]()
+		{
+			hv.values.clear();
+			merge_values_with(&hv.values, in, [](auto *m, sequence_t b, sequence_t e) { pinba::multi_merge__small(m, b, e); });
+		});
+
+		double const loser_tree_d = run([&]()
+		{
+			hv.values.clear();
+			merge_values_with(&hv.values, in, [](auto *m, sequence_t b, sequence_t e) { pinba::multi_merge__loser_tree(m, b, e); });
+		});
+
+		double const dense_d = run([&]()
+		{
+			hv.values.clear();
+			histogram___merge_values___dense(&hv.values, in.values.data(), n_hvs, in.min_id, in.max_id);
+		});
+
+		bool const prefer_dense = histogram___merge_values___prefer_dense(n_hvs, in.n_values, in.min_id, in.max_id);
+
+		double const adaptive_d = run([&]()
+		{
+			histogram___flat_merge_packed(&hv, in.refs.data(), n_hvs);
+		});
+
+		ff::fmt(stdout, "{0}, hvs: {1}, values: {2}, id_range: {3}, result: {4}; pairwise: {5}us, heap: {6}us, small: {7}us, loser_tree: {8}us, dense: {9}us, adaptive ({10}, with unpack): {11}us\n",
+			shape.name, n_hvs, in.n_values, in.max_id - in.min_id + 1, hv.values.size(),
+			ff::as_printf("%.1f", pairwise_d * 1e6),
+			ff::as_printf("%.1f", heap_d * 1e6),
+			ff::as_printf("%.1f", small_d * 1e6),
+			ff::as_printf("%.1f", loser_tree_d * 1e6),
+			ff::as_printf("%.1f", dense_d * 1e6),
+			(prefer_dense) ? "dense" : "multi_merge",
+			ff::as_printf("%.1f", adaptive_d * 1e6));
+	}
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
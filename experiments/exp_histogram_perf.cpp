@@ -6,6 +6,7 @@
 #include <meow/error.hpp>
 
 #include "pinba/globals.h"
+#include "pinba/simd_histogram.h"
 
 // #include "hdr_histogram/hdr_histogram.h"
 
@@ -659,10 +660,77 @@ inline flat_histogram_t histogram___convert_hdr_to_flat(Histogram const& hv, typ
 	return result;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// dense counts kernels (hdr merge and nonzero scan for hdr -> flat conversion)
+// counts are ~1% nonzero, that's what real world tick histograms look like
+
+static void bench_simd_kernels()
+{
+	struct impl_t
+	{
+		char const                     *name;
+		char const                     *cpu_feature;
+		pinba::add_counts_u32_func_t    add_counts;
+		pinba::find_nonzero_u32_func_t  find_nonzero;
+	};
+
+	impl_t const impls[] = {
+		{ "scalar", nullptr,  pinba::add_counts_u32___scalar, pinba::find_nonzero_u32___scalar },
+		{ "sse4",   nullptr,  pinba::add_counts_u32___sse4,   pinba::find_nonzero_u32___sse4   },
+		{ "avx2",   "avx2",   pinba::add_counts_u32___avx2,   pinba::find_nonzero_u32___avx2   },
+	};
+
+	__builtin_cpu_init();
+
+	for (uint32_t const counts_len : { 1024, 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 })
+	{
+		std::vector<uint32_t> src(counts_len, 0);
+		std::vector<uint32_t> dst(counts_len, 0);
+		std::vector<uint32_t> positions(counts_len);
+
+		for (uint32_t i = 0; i < counts_len / 100; i++)
+			src[random() % counts_len] += 1;
+
+		// same amount of work for every size
+		uint32_t const n_runs = std::max<uint32_t>(1, (64 * 1024 * 1024) / counts_len);
+
+		for (auto const& impl : impls)
+		{
+			if (impl.cpu_feature && !__builtin_cpu_supports(impl.cpu_feature))
+				continue;
+
+			std::fill(dst.begin(), dst.end(), 0);
+
+			meow::stopwatch_t sw;
+
+			uint32_t n_nonzero = 0;
+			for (uint32_t i = 0; i < n_runs; i++)
+				n_nonzero += impl.add_counts(dst.data(), src.data(), counts_len);
+
+			double const add_d = timeval_to_double(sw.stamp());
+			sw.reset();
+
+			uint32_t n_found = 0;
+			for (uint32_t i = 0; i < n_runs; i++)
+				n_found += impl.find_nonzero(src.data(), counts_len, positions.data());
+
+			double const find_d = timeval_to_double(sw.stamp());
+
+			ff::fmt(stdout, "counts_len: {0}, {1}; add: {2} ns/merge, find_nonzero: {3} ns/scan (nonzero: {4}, found: {5})\n",
+				counts_len, impl.name,
+				ff::as_printf("%.0f", add_d * 1e9 / n_runs),
+				ff::as_printf("%.0f", find_d * 1e9 / n_runs),
+				n_nonzero, n_found / n_runs);
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char const *argv[])
 {
+	bench_simd_kernels();
+
 	constexpr size_t n_iterations = 1 * 1000 * 1000;
 
 	double hash_d = 1.0;
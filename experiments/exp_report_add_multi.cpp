@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#include <stdexcept>
+
+#include <meow/stopwatch.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "misc/nmpa.h"
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/packet.h"
+#include "pinba/report.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// packets/sec of report aggregation before and after staged add_multi(),
+// for reports with different number of distinct keys (aka rows)
+//  - before: add() for every packet, this is exactly what add_multi() used to do,
+//    add() itself still does the same work per packet (checks, key, one hashtable probe, increment)
+//  - after: add_multi() on whole batches, staged (keys, prefetch buckets, find items, increments)
+// every run gets a fresh aggregator, best of n_rounds is taken, runs are interleaved to share the noise
+//
+// only uses report api that existed before staging, so 'add_multi' numbers of the original code
+// can be taken from the same experiment, built against the tree before staged add_multi() has been added
+//
+// NOTE: aggregation code lives in libpinba, build it with -O3 to get meaningful numbers
+
+static constexpr uint32_t n_packets         = 200 * 1000;
+static constexpr uint32_t batch_size        = 1024;   // roughly what repacker sends
+static constexpr uint32_t timers_per_packet = 10;
+static constexpr uint32_t n_rounds          = 5;
+
+struct packet_set_t
+{
+	struct nmpa_s           nmpa;
+	std::vector<packet_t*>  packets;
+
+	packet_set_t()
+	{
+		nmpa_init(&nmpa, 1024 * 1024);
+	}
+
+	~packet_set_t()
+	{
+		nmpa_free(&nmpa);
+	}
+};
+
+// every packet gets a random script_id and timers with random value for tag_name_id
+static void generate_packets(packet_set_t *ps, uint32_t n_distinct_keys, uint32_t tag_name_id)
+{
+	ps->packets.reserve(n_packets);
+
+	for (uint32_t i = 0; i < n_packets; i++)
+	{
+		auto *p = (packet_t*)nmpa_calloc(&ps->nmpa, sizeof(packet_t));
+
+		p->host_id      = 1;
+		p->server_id    = 1;
+		p->script_id    = 1 + (random() % n_distinct_keys);
+		p->schema_id    = 1;
+		p->status       = 1;
+		p->request_time = 10 * d_millisecond;
+
+		p->timer_count   = timers_per_packet;
+		p->timers        = (packed_timer_t*)nmpa_calloc(&ps->nmpa, sizeof(packed_timer_t) * timers_per_packet);
+		p->timers_blooms = (timer_bloom_t*)nmpa_calloc(&ps->nmpa, sizeof(timer_bloom_t) * timers_per_packet);
+
+		uint32_t *name_ids  = (uint32_t*)nmpa_alloc(&ps->nmpa, sizeof(uint32_t) * timers_per_packet);
+		uint32_t *value_ids = (uint32_t*)nmpa_alloc(&ps->nmpa, sizeof(uint32_t) * timers_per_packet);
+
+		for (uint32_t j = 0; j < timers_per_packet; j++)
+		{
+			packed_timer_t *t = &p->timers[j];
+			t->hit_count     = 1;
+			t->tag_count     = 1;
+			t->value         = 1 * d_millisecond;
+			t->tag_name_ids  = &name_ids[j];
+			t->tag_value_ids = &value_ids[j];
+
+			name_ids[j]  = tag_name_id;
+			value_ids[j] = 1 + (random() % n_distinct_keys);
+
+			p->timers_blooms[j].add(tag_name_id);
+		}
+		p->bloom.add(tag_name_id);
+
+		ps->packets.push_back(p);
+	}
+}
+
+static double run_add(report_t *report, packet_set_t const& ps)
+{
+	report_stats_t stats;
+
+	report_agg_ptr agg = report->create_aggregator();
+	agg->stats_init(&stats);
+
+	meow::stopwatch_t sw;
+
+	for (auto *packet : ps.packets)
+		agg->add(packet);
+
+	return timeval_to_double(sw.stamp());
+}
+
+static double run_add_multi(report_t *report, packet_set_t const& ps)
+{
+	report_stats_t stats;
+
+	report_agg_ptr agg = report->create_aggregator();
+	agg->stats_init(&stats);
+
+	meow::stopwatch_t sw;
+
+	packet_t **packets = const_cast<packet_t**>(ps.packets.data());
+	for (uint32_t i = 0; i < ps.packets.size(); i += batch_size)
+	{
+		uint32_t const n = std::min<uint32_t>(batch_size, ps.packets.size() - i);
+		agg->add_multi(packets + i, n);
+	}
+
+	return timeval_to_double(sw.stamp());
+}
+
+static void run_report(str_ref name, report_t *report, packet_set_t const& ps, uint32_t n_distinct_keys)
+{
+	double before_d = std::numeric_limits<double>::max();
+	double after_d  = std::numeric_limits<double>::max();
+
+	for (uint32_t i = 0; i < n_rounds; i++)
+	{
+		before_d = std::min(before_d, run_add(report, ps));
+		after_d  = std::min(after_d, run_add_multi(report, ps));
+	}
+
+	ff::fmt(stdout, "{0}, keys: {1}; before (add loop): {2} packets/sec, after (staged add_multi): {3} packets/sec, speedup: {4}\n",
+		name, n_distinct_keys,
+		ff::as_printf("%.0f", ps.packets.size() / before_d),
+		ff::as_printf("%.0f", ps.packets.size() / after_d),
+		ff::as_printf("%.2f", before_d / after_d));
+}
+
+int main(int argc, char const *argv[])
+try
+{
+	pinba_options_t options = {};
+	pinba_globals_t *globals = pinba_globals_init(&options);
+
+	uint32_t const tag_name_id = globals->dictionary()->add_nameword("tag").id;
+
+	for (uint32_t const n_distinct_keys : { 1000, 100 * 1000, 1000 * 1000 })
+	{
+		packet_set_t ps;
+		generate_packets(&ps, n_distinct_keys, tag_name_id);
+
+		{
+			report_conf___by_request_t conf = {};
+			conf.name        = "by_request";
+			conf.time_window = 60 * d_second;
+			conf.tick_count  = 60;
+			conf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field("script", &packet_t::script_id));
+
+			report_ptr report = create_report_by_request(globals, conf);
+			run_report("by_request", report.get(), ps, n_distinct_keys);
+		}
+
+		{
+			report_conf___by_timer_t conf = {};
+			conf.name        = "by_timer";
+			conf.time_window = 60 * d_second;
+			conf.tick_count  = 60;
+			conf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_timer_tag("tag", tag_name_id));
+
+			report_ptr report = create_report_by_timer(globals, conf);
+			run_report("by_timer", report.get(), ps, n_distinct_keys);
+		}
+	}
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
@@ -83,6 +83,20 @@ static inline void nmpa_empty(struct nmpa_s *nmpa)
 }
 
 
+/* like nmpa_empty(), but keeps all pool chunks for reuse (big chunks are freed) */
+static inline void nmpa_reset(struct nmpa_s *nmpa)
+{
+	unsigned i;
+	for (i = 0; i < nmpa->big_chunks.used; i++) {
+		struct array_s *a = array_v(&nmpa->big_chunks, struct array_s) + i;
+		array_free(a);
+	}
+
+	nmpa->big_chunks.used = 0;
+	nmpa->next_empty = 0;
+}
+
+
 static inline void nmpa_free(struct nmpa_s *nmpa)
 {
 	nmpa_empty(nmpa);
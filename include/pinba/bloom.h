@@ -68,6 +68,62 @@ namespace pinba {
 		}
 	};
 
+	// exact set of small dense ids, with bloom-like fallback for large ones
+	// nameword ids (tag names) are dense, start at 1 and are low-cardinality (only names used by reports get an id)
+	// so for most installations every id gets it's own bit and contains() has no false positives
+	// ids that don't fit share a small overflow area at the top, contains() might give false positives for those
+	template<size_t N>
+	struct fixlen_idset_t : private boost::noncopyable
+	{
+		using self_t = fixlen_idset_t<N>;
+		using bits_t = std::bitset<N>;
+
+		static_assert(meow::static_is_pow<N, 2>::value == true, "N must be a power of 2");
+
+		static constexpr size_t n_overflow = N / 8;
+		static constexpr size_t n_exact    = N - n_overflow;
+
+	private:
+		bits_t           bits_;
+
+	public:
+
+		constexpr fixlen_idset_t()
+		{
+			static_assert(std::is_standard_layout<self_t>::value, "don't mess with fixlen_idset_t<>");
+		}
+
+		static size_t bit_for_id(uint32_t id)
+		{
+			return (id < n_exact)
+					? id
+					: n_exact + (id & (n_overflow - 1)); // ids are dense, no need to hash
+		}
+
+		void add(uint32_t id)
+		{
+			bits_.set(bit_for_id(id));
+		}
+
+		void reset()
+		{
+			bits_.reset();
+		}
+
+		bool contains(self_t const& other) const
+		{
+			return (bits_ & other.bits_) == other.bits_;
+		}
+
+		std::string to_string() const
+		{
+			return bits_.to_string();
+		}
+	};
+
+	static_assert(fixlen_idset_t<64>::n_exact == 56, "");
+	static_assert(fixlen_idset_t<128>::n_exact == 112, "");
+
 	// simple tests for different power of 2 sizes
 	static_assert(fixlen_bloom_t<64>::mask  == 0x3f, "");
 	static_assert(fixlen_bloom_t<64>::shift == 6, "");
@@ -82,11 +138,15 @@ namespace pinba {
 } // namespace pinba {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-// bloom with all timer tag names from a packet
-struct timertag_bloom_t : public pinba::fixlen_bloom_t<128> {};
+// set of all timer tag names from a packet
+// (named 'bloom' for historical reasons, it's exact for first fixlen_idset_t<128>::n_exact tag names)
+struct timertag_bloom_t : public pinba::fixlen_idset_t<128> {};
+
+// set of all timer tag names from a timer
+struct timer_bloom_t : public pinba::fixlen_idset_t<64> {};
 
-// bloom with all timer tag names from a timer
-struct timer_bloom_t : public pinba::fixlen_bloom_t<64> {};
+// set of all request tag names from a packet
+struct requesttag_bloom_t : public pinba::fixlen_idset_t<64> {};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
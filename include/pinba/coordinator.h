@@ -25,6 +25,10 @@ struct coordinator_t : private boost::noncopyable
 	virtual pinba_error_t       add_report(report_ptr report) = 0;
 	virtual pinba_error_t       delete_report(std::string const& name) = 0;
 	virtual report_snapshot_ptr get_report_snapshot(std::string const& name) = 0;
+
+	// get snapshot prepared with (at least) flags
+	// snapshots are cached per report until the next tick, so repeated/concurrent selects share one merge
+	virtual report_snapshot_ptr get_report_snapshot_prepared(std::string const& name, report_snapshot_t::merge_flags_t flags) = 0;
 	virtual report_state_ptr    get_report_state(std::string const& name) = 0;
 };
 typedef std::unique_ptr<coordinator_t> coordinator_ptr;
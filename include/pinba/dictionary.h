@@ -124,8 +124,7 @@ struct nameword_dictionary_t : public meow::ref_counted_t
 {
 	struct nameword_t
 	{
-		uint32_t id       = 0;
-		uint64_t id_hash  = 0;
+		uint32_t id       = 0;   // dense, starting from 1, used as bit index in packet/timer tag sets (see bloom.h)
 		uint64_t str_hash = 0;
 	};
 	static_assert(std::is_nothrow_move_constructible<nameword_t>::value);
@@ -214,7 +213,6 @@ public:
 
 		nameword_t nw = {
 			.id       = word_id,
-			.id_hash  = pinba::hash_number(word_id),
 			.str_hash = word_hash,
 		};
 
@@ -437,6 +435,25 @@ public:
 		return str_ref { w->str }; // TODO: optimize pointer deref here (string::size(), etc.)
 	}
 
+	// lookup word_id without adding the word, returns 0 if word is not in dictionary
+	// (aka no report row can have this word in key)
+	uint32_t find_word_id(str_ref const word) const
+	{
+		if (!word)
+			return 0;
+
+		uint64_t const word_hash = hash_dictionary_word(word);
+		shard_t const *shard = get_shard_for_word_hash(word_hash);
+
+		scoped_read_lock_t lock_(shard->mtx);
+
+		auto const it = shard->hash.find(word, word_hash);
+		if (it == shard->hash.end())
+			return 0;
+
+		return it->second->id;
+	}
+
 	void erase_word___ref(uint32_t word_id) // pair to get_or_add___ref()
 	{
 		if (word_id == 0)
@@ -23,6 +23,7 @@ struct pinba_engine_t : private boost::noncopyable
 	virtual pinba_error_t       delete_report(str_ref name) = 0;
 	virtual report_state_ptr    get_report_state(str_ref name) = 0;
 	virtual report_snapshot_ptr get_report_snapshot(str_ref name) = 0;
+	virtual report_snapshot_ptr get_report_snapshot_prepared(str_ref name, report_snapshot_t::merge_flags_t flags) = 0;
 };
 typedef std::unique_ptr<pinba_engine_t> pinba_engine_ptr;
 
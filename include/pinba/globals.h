@@ -155,6 +155,7 @@ struct pinba_options_t
 
 	uint32_t    coordinator_input_buffer;
 	uint32_t    report_input_buffer;
+	uint32_t    report_merge_threads;   // threads to merge big ticks into report history with, 0 or 1 = merge in report thread
 
 	pinba_logger_ptr logger;
 
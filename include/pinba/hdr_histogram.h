@@ -1,6 +1,7 @@
 #ifndef PINBA__HDR_HISTOGRAM_H_
 #define PINBA__HDR_HISTOGRAM_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <cmath>   // ceil
 #include <memory>
@@ -16,6 +17,7 @@
 
 #include "pinba/globals.h"
 #include "pinba/limits.h"
+#include "pinba/simd_histogram.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -124,6 +126,43 @@ inline meow::error_t hdr_histogram_configure___sig_figures(
 	return hdr_histogram_configure(cfg, lowest_trackable_value, highest_trackable_value, sig_bits);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// dense counts kernels, uint32_t counters (the ones we actually use) get simd versions
+
+template<class CounterT>
+inline uint32_t hdr___add_counts(CounterT *dst, CounterT const *src, uint32_t size)
+{
+	uint32_t n_new = 0;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		n_new  += (dst[i] == 0) && (src[i] != 0);
+		dst[i] += src[i];
+	}
+	return n_new;
+}
+
+inline uint32_t hdr___add_counts(uint32_t *dst, uint32_t const *src, uint32_t size)
+{
+	return pinba::add_counts_u32(dst, src, size);
+}
+
+template<class CounterT>
+inline uint32_t hdr___find_nonzero(CounterT const *values, uint32_t size, uint32_t *positions)
+{
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		if (values[i] != 0)
+			positions[n++] = i;
+	}
+	return n;
+}
+
+inline uint32_t hdr___find_nonzero(uint32_t const *values, uint32_t size, uint32_t *positions)
+{
+	return pinba::find_nonzero_u32(values, size, positions);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 template<class CounterT>
@@ -153,11 +192,9 @@ public:
 		unit_magnitude                  = conf.unit_magnitude;
 		sub_bucket_half_count_magnitude = conf.sub_bucket_half_count_magnitude;
 
-		// allocate small part on init
-		counts_len_                     = conf.sub_bucket_half_count;
-		counts_ = (counter_t*)nmpa_calloc(nmpa_, counts_len_ * sizeof(counter_t));
-		if (counts_ == nullptr)
-			throw std::bad_alloc();
+		// start sparse, nothing is allocated until we have more than sparse_capacity distinct values
+		// most rows in a tick only ever see a couple of distinct values
+		counts_len_                     = 0;
 	}
 
 	~hdr_histogram___impl_t()
@@ -179,7 +216,7 @@ public:
 
 	hdr_histogram___impl_t& operator=(hdr_histogram___impl_t&& other) noexcept
 	{
-		nmpa_                           = other.nmpa;
+		nmpa_                           = other.nmpa_;
 
 		negative_inf_                   = other.negative_inf_;
 		positive_inf_                   = other.positive_inf_;
@@ -194,8 +231,12 @@ public:
 		unit_magnitude                  = other.unit_magnitude;
 		sub_bucket_half_count_magnitude = other.sub_bucket_half_count_magnitude;
 
-		counts_ = other.counts_;
-		other.counts_ = nullptr;
+		// copies either sparse entries or counts pointer
+		memcpy(&storage_, &other.storage_, sizeof(storage_));
+
+		// leave other as empty sparse histogram
+		other.counts_nonzero_ = 0;
+		other.counts_len_     = 0;
 
 		return *this;
 	}
@@ -206,19 +247,36 @@ public: // reads
 	counter_t positive_inf() const noexcept { return positive_inf_; }
 	uint64_t  total_count() const noexcept { return total_count_; }
 	uint32_t  counts_nonzero() const noexcept { return counts_nonzero_; }
-	uint32_t  counts_len() const noexcept { return counts_len_; }
+	uint32_t  counts_len() const noexcept { return counts_len_; } // 0 when sparse
+	bool      is_sparse() const noexcept { return (counts_len_ == 0); }
+
+	struct sparse_entry_t
+	{
+		uint32_t  index;
+		counter_t count;
+	};
+
+	static constexpr uint32_t sparse_capacity = 4;
 
 	using counts_range_t    = meow::string_ref<counter_t const>;
 	using counts_range_nc_t = meow::string_ref<counter_t>;
+	using sparse_range_t    = meow::string_ref<sparse_entry_t const>;
 
+	// dense counts, empty when sparse
 	counts_range_t get_counts_range() const
 	{
-		return { this->counts_, this->counts_len_ };
+		return { this->counts_ptr(), this->counts_len_ };
 	}
 
 	counts_range_nc_t mutable_counts_range()
 	{
-		return { this->counts_, this->counts_len_ };
+		return { this->counts_ptr(), this->counts_len_ };
+	}
+
+	// sparse entries sorted by index, empty when dense
+	sparse_range_t get_sparse_range() const
+	{
+		return { storage_.sparse, this->is_sparse() ? this->counts_nonzero_ : 0 };
 	}
 
 	uint64_t get_allocated_size() const
@@ -226,6 +284,37 @@ public: // reads
 		return sizeof(counter_t) * this->counts_len_;
 	}
 
+	// calls func(index, count) for every nonzero counter, in index order
+	template<class Function>
+	void for_each_nonzero(Function const& func) const
+	{
+		if (this->is_sparse())
+		{
+			for (uint32_t i = 0; i < counts_nonzero_; i++)
+				func(storage_.sparse[i].index, storage_.sparse[i].count);
+			return;
+		}
+
+		// find nonzero counters blockwise, stop as soon as all of them have been seen
+		constexpr uint32_t block_size = 1024;
+		uint32_t positions[block_size];
+
+		counter_t const *counts = storage_.counts;
+		uint32_t n_found = 0;
+
+		for (uint32_t base = 0; (base < counts_len_) && (n_found < counts_nonzero_); base += block_size)
+		{
+			uint32_t const n = hdr___find_nonzero(counts + base, std::min(block_size, counts_len_ - base), positions);
+
+			for (uint32_t i = 0; i < n; i++)
+				func(base + positions[i], counts[base + positions[i]]);
+
+			n_found += n;
+		}
+
+		assert(n_found == counts_nonzero_);
+	}
+
 public:
 
 	bool increment(config_t const& conf, int64_t value, counter_t increment_by = 1) noexcept
@@ -250,27 +339,15 @@ public:
 		}
 		else {
 			int32_t const counts_index = counts_index_for(value);
-			// assert((counts_index >= 0) && ((uint32_t)counts_index < this->counts_len_));
+			// assert((counts_index >= 0) && ((uint32_t)counts_index < this->counts_maxlen_));
 
-			if ((uint32_t)counts_index >= counts_len_)
+			if (!this->add_at_index(counts_index, increment_by))
 			{
-				counter_t *tmp = (counter_t*)nmpa_realloc(nmpa_, counts_, counts_len_ * sizeof(counter_t), counts_maxlen_ * sizeof(counter_t));
-				if (tmp == nullptr)
-				{
-					// we're noexcept, can't throw, so silently ignore the operation, best we can do for the time being
-					// TODO: fix this somehow properly (maybe have a counter for this error type? needed at all? reasonable reaction possible?)
-					// throw std::bad_alloc();
-					return false;
-				}
-				std::uninitialized_fill(tmp + counts_len_, tmp + counts_maxlen_, 0);
-				counts_len_ = counts_maxlen_;
-				counts_ = tmp;
+				// we're noexcept, can't throw, so silently ignore the operation, best we can do for the time being
+				// TODO: fix this somehow properly (maybe have a counter for this error type? needed at all? reasonable reaction possible?)
+				// throw std::bad_alloc();
+				return false;
 			}
-
-			counter_t& counter = this->counts_[counts_index];
-
-			counts_nonzero_ += (counter == 0);
-			counter         += increment_by;
 		}
 
 		this->total_count_ += increment_by;
@@ -281,26 +358,23 @@ public:
 	{
 		assert(this->counts_maxlen_ == other.counts_maxlen_);
 
-		if (this->counts_len_ < other.counts_len_)
+		if (other.is_sparse())
 		{
-			counter_t *tmp = (counter_t*)nmpa_realloc(nmpa_, counts_, counts_len_ * sizeof(counter_t), counts_maxlen_ * sizeof(counter_t));
-			if (tmp == nullptr)
-				throw std::bad_alloc();
-
-			std::uninitialized_fill(tmp + counts_len_, tmp + counts_maxlen_, 0);
-			counts_len_ = counts_maxlen_;
-			counts_ = tmp;
+			for (uint32_t i = 0; i < other.counts_nonzero_; i++)
+			{
+				if (!this->add_at_index(other.storage_.sparse[i].index, other.storage_.sparse[i].count))
+					throw std::bad_alloc();
+			}
 		}
-
-		for (uint32_t i = 0; i < other.counts_len_; i++)
+		else
 		{
-			counter_t&       dst_counter = this->counts_[i];
-			counter_t const& src_counter = other.counts_[i];
-
-			if ((dst_counter == 0) && (src_counter != 0))
-				this->counts_nonzero_ += 1;
+			if (this->counts_len_ < other.counts_len_)
+			{
+				if (!this->grow_dense(other.counts_len_))
+					throw std::bad_alloc();
+			}
 
-			dst_counter += src_counter;
+			this->counts_nonzero_ += hdr___add_counts(this->storage_.counts, other.storage_.counts, other.counts_len_);
 		}
 
 		this->negative_inf_ += other.negative_inf_;
@@ -308,6 +382,94 @@ public:
 		this->total_count_ += other.total_count_;
 	}
 
+private:
+
+	counter_t* counts_ptr() const
+	{
+		return this->is_sparse() ? nullptr : storage_.counts;
+	}
+
+	// adds count to counter at index, keeps sparse form while possible
+	bool add_at_index(uint32_t index, counter_t count) noexcept
+	{
+		if (this->is_sparse())
+		{
+			sparse_entry_t *entries = storage_.sparse;
+
+			uint32_t pos = 0;
+			while ((pos < counts_nonzero_) && (entries[pos].index < index))
+				pos++;
+
+			if ((pos < counts_nonzero_) && (entries[pos].index == index))
+			{
+				entries[pos].count += count;
+				return true;
+			}
+
+			if (counts_nonzero_ < sparse_capacity)
+			{
+				for (uint32_t i = counts_nonzero_; i > pos; i--)
+					entries[i] = entries[i - 1];
+
+				entries[pos] = { .index = index, .count = count };
+				counts_nonzero_ += 1;
+				return true;
+			}
+
+			// out of inline space, promote to dense
+			uint32_t const max_index = std::max(index, entries[counts_nonzero_ - 1].index);
+			if (!this->grow_dense(max_index + 1))
+				return false;
+		}
+		else if (index >= counts_len_)
+		{
+			if (!this->grow_dense(index + 1))
+				return false;
+		}
+
+		counter_t& counter = storage_.counts[index];
+
+		counts_nonzero_ += (counter == 0);
+		counter         += count;
+		return true;
+	}
+
+	// make counts dense, with at least min_len counters
+	// allocate small part first (most values fit there), full length otherwise
+	bool grow_dense(uint32_t min_len) noexcept
+	{
+		uint32_t const new_len = (min_len <= sub_bucket_half_count)
+								? std::max<uint32_t>(sub_bucket_half_count, counts_len_)
+								: counts_maxlen_;
+
+		if (this->is_sparse())
+		{
+			counter_t *tmp = (counter_t*)nmpa_calloc(nmpa_, new_len * sizeof(counter_t));
+			if (tmp == nullptr)
+				return false;
+
+			// entries share storage with counts pointer, must be read before it's overwritten
+			for (uint32_t i = 0; i < counts_nonzero_; i++)
+				tmp[storage_.sparse[i].index] = storage_.sparse[i].count;
+
+			storage_.counts = tmp;
+			counts_len_     = new_len;
+			return true;
+		}
+
+		if (new_len <= counts_len_)
+			return true;
+
+		counter_t *tmp = (counter_t*)nmpa_realloc(nmpa_, storage_.counts, counts_len_ * sizeof(counter_t), new_len * sizeof(counter_t));
+		if (tmp == nullptr)
+			return false;
+
+		std::uninitialized_fill(tmp + counts_len_, tmp + new_len, 0);
+		storage_.counts = tmp;
+		counts_len_     = new_len;
+		return true;
+	}
+
 public:
 
 	inline int64_t get_percentile(config_t const& conf, double percentile) const
@@ -342,51 +504,69 @@ public:
 
 		// slowpath - shut up and calculate
 		uint64_t current_sum = 0;
+		int64_t  result      = 0;
 
-		auto const counts_r = this->get_counts_range();
-
-		for (uint32_t i = 0; i < counts_r.size(); i++)
+		// returns true when percentile value is found within this bucket
+		auto const take_bucket = [&](uint32_t bucket_id, uint64_t next_has_values) -> bool
 		{
-			uint32_t const bucket_id       = i;
-			uint64_t const next_has_values = counts_r[i];
-			uint64_t const need_values     = required_sum - current_sum;
+			uint64_t const need_values = required_sum - current_sum;
 
 			if (next_has_values < need_values) // take bucket and move on
 			{
 				current_sum += next_has_values;
 				// meow::format::fmt(stderr, "[{0}] current_sum +=; {1} -> {2}\n", bucket_id, next_has_values, current_sum);
-				continue;
+				return false;
 			}
 
 			if (next_has_values == need_values) // complete bucket, return upper time bound for this bucket
 			{
 				// meow::format::fmt(stderr, "[{0}] full; current_sum +=; {1} -> {2}\n", bucket_id, next_has_values, current_sum);
-				int64_t const result = this->highest_equivalent_value(this->value_at_index(bucket_id));
-				return (result < conf.highest_trackable_value)
-						? result
-						: conf.highest_trackable_value;
+				result = this->highest_equivalent_value(this->value_at_index(bucket_id));
 			}
-
-			// incomplete bucket, interpolate, assuming flat time distribution within bucket
+			else // incomplete bucket, interpolate, assuming flat time distribution within bucket
 			{
 				int64_t const d = this->size_of_equivalent_value_range(bucket_id) * need_values / next_has_values;
 
 				// meow::format::fmt(stderr, "[{0}] last, has: {1}, taking: {2}, {3}\n", bucket_id, next_has_values, need_values, d);
-				int64_t const result = this->lowest_equivalent_value(this->value_at_index(bucket_id)) + d;
-				return (result < conf.highest_trackable_value)
-						? result
-						: conf.highest_trackable_value;
+				result = this->lowest_equivalent_value(this->value_at_index(bucket_id)) + d;
+			}
+
+			if (result > conf.highest_trackable_value)
+				result = conf.highest_trackable_value;
+			return true;
+		};
+
+		if (this->is_sparse())
+		{
+			auto const sparse_r = this->get_sparse_range();
+
+			for (uint32_t i = 0; i < sparse_r.size(); i++)
+			{
+				if (take_bucket(sparse_r[i].index, sparse_r[i].count))
+					return result;
+			}
+		}
+		else
+		{
+			auto const counts_r = this->get_counts_range();
+
+			for (uint32_t i = 0; i < counts_r.size(); i++)
+			{
+				if (take_bucket(i, counts_r[i]))
+					return result;
 			}
 		}
 
 		// dump hv contents to stderr, as we're going to die anyway
 		{
 			meow::format::fmt(stderr, "{0} internal failure, dumping histogram\n", __func__);
-			meow::format::fmt(stderr, "{0} neg_inf: {1}, pos_inf: {2}, total_count: {3}, hv_size: {4}\n",
-				__func__, this->negative_inf(), this->positive_inf(), this->total_count(), this->counts_len_);
+			meow::format::fmt(stderr, "{0} neg_inf: {1}, pos_inf: {2}, total_count: {3}, hv_size: {4}, sparse: {5}\n",
+				__func__, this->negative_inf(), this->positive_inf(), this->total_count(), this->counts_len_, this->is_sparse());
 
-			for (uint32_t i = 0; i < counts_r.size(); i++)
-				meow::format::fmt(stderr, "[{0}] -> {1}\n", this->value_at_index(i), this->count_at_index(i));
+			this->for_each_nonzero([this](uint32_t index, counter_t count)
+			{
+				meow::format::fmt(stderr, "[{0}] -> {1}\n", this->value_at_index(index), count);
+			});
 		}
 
 		assert(!"must not be reached");
@@ -396,7 +576,17 @@ public:
 
 	inline counter_t count_at_index(int32_t index) const
 	{
-		return this->counts_[index];
+		if (this->is_sparse())
+		{
+			for (uint32_t i = 0; i < counts_nonzero_; i++)
+			{
+				if (storage_.sparse[i].index == (uint32_t)index)
+					return storage_.sparse[i].count;
+			}
+			return 0;
+		}
+
+		return storage_.counts[index];
 	}
 
 	inline int64_t value_at_index(int32_t index) const
@@ -496,30 +686,34 @@ private:
 	uint64_t   total_count_;
 	// 32
 
-	counter_t  *counts_;
-	// 40
+	// sparse when counts_len_ == 0, counts_nonzero_ entries are used then
+	union {
+		counter_t      *counts;
+		sparse_entry_t  sparse[sparse_capacity];
+	} storage_;
+	// 64
 
 	uint32_t    counts_maxlen_;
 	counter_t   negative_inf_;
 	counter_t   positive_inf_;
 	uint32_t    padding____; // explicitly put it somewhere, as we know it exists
-	// 56
+	// 80
 };
-static_assert(sizeof(hdr_histogram___impl_t<uint32_t>) == 56, "");
+static_assert(sizeof(hdr_histogram___impl_t<uint32_t>) == 80, "");
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 template<class SinkT, class Histogram>
 inline void hdr_histogram___debug_dump(SinkT& sink, Histogram const& hv, meow::str_ref func_name)
 {
-	auto const counts_r = hv.get_counts_range();
-
 	meow::format::fmt(stderr, "{0} internal failure, dumping histogram\n", func_name);
-	meow::format::fmt(stderr, "{0} neg_inf: {1}, pos_inf: {2}, total_count: {3}, hv_size: {4}\n",
-		func_name, hv.negative_inf(), hv.positive_inf(), hv.total_count(), counts_r.size());
+	meow::format::fmt(stderr, "{0} neg_inf: {1}, pos_inf: {2}, total_count: {3}, hv_size: {4}, sparse: {5}\n",
+		func_name, hv.negative_inf(), hv.positive_inf(), hv.total_count(), hv.counts_len(), hv.is_sparse());
 
-	for (uint32_t i = 0; i < counts_r.size(); i++)
-		meow::format::fmt(stderr, "  [{0}] -> {1}\n", hv.value_at_index(i), hv.count_at_index(i));
+	hv.for_each_nonzero([&hv](uint32_t index, uint64_t count)
+	{
+		meow::format::fmt(stderr, "  [{0}] -> {1}\n", hv.value_at_index(index), count);
+	});
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
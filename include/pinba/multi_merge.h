@@ -1,7 +1,12 @@
 #ifndef PINBA__MULTI_MERGE_H_
 #define PINBA__MULTI_MERGE_H_
 
+#include <alloca.h>
 #include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <type_traits>
 
 // #include "binheap/binary_heap.c" // FIXME
 
@@ -17,6 +22,46 @@ namespace pinba {
 			I    iter;  // current value iterator
 		};
 
+		template<class Iterator>
+		inline size_t maybe_calculate_size(Iterator begin, Iterator end);
+
+		template<class Seq, class I>
+		struct merge_cursor_t
+		{
+			Seq *seq;   // source sequence
+			I    iter;  // current value iterator
+			I    end;   // sequence end
+		};
+
+		// collect non-empty sequences from [begin, end) into cursors, returns number of cursors
+		// result is reserved for the total length (when it can be calculated cheaply)
+		template<class Merger, class Iterator, class Cursor>
+		inline uint32_t merge_cursors_init(Merger *result, Iterator begin, Iterator end, Cursor *cursors)
+		{
+			uint32_t n_cursors     = 0;
+			size_t   result_length = 0;
+
+			for (auto i = begin; i != end; i = std::next(i))
+			{
+				auto *sequence = *i;
+
+				auto const curr_b = std::begin(*sequence);
+				auto const curr_e = std::end(*sequence);
+
+				if (curr_b == curr_e)
+					continue;
+
+				result_length += maybe_calculate_size(curr_b, curr_e);
+
+				new (&cursors[n_cursors++]) Cursor { sequence, curr_b, curr_e };
+			}
+
+			if (result_length > 0)
+				result->reserve(result_length);
+
+			return n_cursors;
+		}
+
 		template<class Iterator>
 		inline size_t maybe_calculate_size_impl(Iterator begin, Iterator end, std::random_access_iterator_tag)
 		{
@@ -122,6 +167,118 @@ namespace pinba {
 		}
 	}
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// same as multi_merge__stdlib(), for a few sequences (up to 4 or so, see multi_merge())
+	// note: here and below, compare(l, r) is used as 'l < r'
+	// heads are scanned linearly, selection compiles to conditional moves, exhausted sequences are swapped out
+	template<class Merger, class Iterator>
+	inline void multi_merge__small(Merger *result, Iterator begin, Iterator end)
+	{
+		using SequencePtr = typename std::iterator_traits<Iterator>::value_type;
+		static_assert(std::is_pointer<SequencePtr>::value, "expected a range of pointers to sequences");
+
+		using SequenceT    = typename std::remove_pointer<SequencePtr>::type;
+		using SequenceIter = typename SequenceT::const_iterator;
+
+		using cursor_t = detail::merge_cursor_t<SequenceT, SequenceIter>;
+
+		size_t const input_size = std::distance(begin, end);
+
+		cursor_t *cursors   = (cursor_t*)alloca(input_size * sizeof(cursor_t));
+		uint32_t  n_cursors = detail::merge_cursors_init(result, begin, end, cursors);
+
+		while (n_cursors > 0)
+		{
+			uint32_t best = 0;
+			for (uint32_t i = 1; i < n_cursors; i++)
+				best = result->compare(*cursors[i].iter, *cursors[best].iter) ? i : best;
+
+			cursor_t& c = cursors[best];
+			result->push_back(c.seq, *c.iter);
+
+			if (++c.iter == c.end)
+				c = cursors[--n_cursors];
+		}
+	}
+
+	// same as multi_merge__stdlib(), with a tournament (loser) tree instead of a binary heap
+	// every output value takes exactly log2(k) comparisons (heap takes up to 2*log2(k)), all on the path from one leaf
+	template<class Merger, class Iterator>
+	inline void multi_merge__loser_tree(Merger *result, Iterator begin, Iterator end)
+	{
+		using SequencePtr = typename std::iterator_traits<Iterator>::value_type;
+		static_assert(std::is_pointer<SequencePtr>::value, "expected a range of pointers to sequences");
+
+		using SequenceT    = typename std::remove_pointer<SequencePtr>::type;
+		using SequenceIter = typename SequenceT::const_iterator;
+
+		using cursor_t = detail::merge_cursor_t<SequenceT, SequenceIter>;
+
+		size_t const input_size = std::distance(begin, end);
+
+		cursor_t *cursors   = (cursor_t*)alloca(input_size * sizeof(cursor_t));
+		uint32_t  n_cursors = detail::merge_cursors_init(result, begin, end, cursors);
+
+		if (n_cursors == 0)
+			return;
+
+		// leaves are cursors, padded to power of 2 with exhausted ones
+		uint32_t n_leaves = 1;
+		while (n_leaves < n_cursors)
+			n_leaves *= 2;
+
+		// internal nodes [1, n_leaves) keep the loser of the match played there, winner moves up
+		uint32_t *losers  = (uint32_t*)alloca(n_leaves * sizeof(uint32_t));
+		uint32_t *winners = (uint32_t*)alloca(n_leaves * sizeof(uint32_t));
+
+		bool *exhausted = (bool*)alloca(n_leaves * sizeof(bool));
+		for (uint32_t i = 0; i < n_leaves; i++)
+			exhausted[i] = (i >= n_cursors);
+
+		// exhausted leaves always lose
+		auto const leaf_less = [&](uint32_t l, uint32_t r) -> bool
+		{
+			if (exhausted[l])
+				return false;
+			if (exhausted[r])
+				return true;
+			return result->compare(*cursors[l].iter, *cursors[r].iter);
+		};
+
+		// initial tournament, bottom up
+		for (uint32_t node = n_leaves - 1; node >= 1; node--)
+		{
+			uint32_t const l_child = 2 * node;
+			uint32_t const r_child = 2 * node + 1;
+
+			uint32_t const l = (l_child >= n_leaves) ? (l_child - n_leaves) : winners[l_child];
+			uint32_t const r = (r_child >= n_leaves) ? (r_child - n_leaves) : winners[r_child];
+
+			bool const l_wins = !leaf_less(r, l);
+			winners[node] = l_wins ? l : r;
+			losers[node]  = l_wins ? r : l;
+		}
+
+		uint32_t winner = (n_leaves > 1) ? winners[1] : 0;
+
+		while (!exhausted[winner])
+		{
+			cursor_t& c = cursors[winner];
+			result->push_back(c.seq, *c.iter);
+
+			if (++c.iter == c.end)
+				exhausted[winner] = true;
+
+			// replay matches on the path from winner leaf to the root
+			for (uint32_t node = (winner + n_leaves) / 2; node >= 1; node /= 2)
+			{
+				if (leaf_less(losers[node], winner))
+					std::swap(losers[node], winner);
+			}
+		}
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 #if 0
 	// merge a range (defined by 'begin' and 'end') of pointers to *sorted* sequences into 'result'
@@ -211,7 +368,13 @@ namespace pinba {
 	template<class Merger, class Iterator>
 	inline void multi_merge(Merger *result, Iterator begin, Iterator end)
 	{
-		return multi_merge__stdlib(result, begin, end);
+		// loser tree wins over binary heap for any k, and over linear scan from k > 4
+		// about 2x faster than pairwise in place merges for 16+ sparse histograms, see experiments/exp_histogram_merge.cpp
+		if (std::distance(begin, end) <= 4)
+			return multi_merge__small(result, begin, end);
+
+		return multi_merge__loser_tree(result, begin, end);
+		// return multi_merge__stdlib(result, begin, end);
 		// return multi_merge__binheap(result, begin, end);
 	}
 
@@ -93,19 +93,59 @@ struct packet_t
 	duration_t        request_time;    // use microseconds_t here?
 	duration_t        ru_utime;        // use microseconds_t here?
 	duration_t        ru_stime;        // use microseconds_t here?
-	uint32_t          *tag_name_ids;   // request tag names  (sequential in memory = scan speed)
+	uint32_t          *tag_name_ids;   // request tag names  (sequential in memory = scan speed), sorted by name_id
 	uint32_t          *tag_value_ids;  // request tag values (sequential in memory = scan speed) TODO: remove this ptr, address via tag_name_ids
-	timer_bloom_t     *timers_blooms;  // blooms for all timers, sequential for check speed
+	timer_bloom_t     *timers_blooms;  // tag name sets for all timers, sequential for check speed
 	packed_timer_t    *timers;
-	timertag_bloom_t  bloom;     // poor man's bloom filter over timer[].tag_name_ids
+	timertag_bloom_t  bloom;     // set of all timer[].tag_name_ids (exact for low name ids, see bloom.h)
+	requesttag_bloom_t rtag_bloom; // same for tag_name_ids
 };
 
 // packet_t has been carefully crafted to avoid padding inside and eat as little memory as possible
 // make sure we haven't made a mistake anywhere
 // static_assert(sizeof(packet_t) == 96, "make sure packet_t has no padding inside");
-static_assert(sizeof(packet_t) == 104, "make sure packet_t has no padding inside");
+// static_assert(sizeof(packet_t) == 104, "make sure packet_t has no padding inside");
+static_assert(sizeof(packet_t) == 112, "make sure packet_t has no padding inside");
 static_assert(std::is_standard_layout<packet_t>::value == true, "packet_t must be a standard layout type");
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// request tag lookup
+// pinba_request_to_packet() keeps packet->tag_name_ids sorted (stable, dups keep their original order)
+// so every report can search it instead of scanning all tags for every key part and filter
+
+// returns pointer to value id of the first tag named name_id, or nullptr if packet has no such tag
+inline uint32_t const* packet___find_request_tag(packet_t const *packet, uint32_t name_id)
+{
+	uint32_t const *names = packet->tag_name_ids;
+	uint32_t const n_tags = packet->tag_count;
+
+	// most packets have just a few tags, linear scan with early exit is faster than bsearch there
+	if (n_tags <= 8)
+	{
+		for (uint32_t i = 0; i < n_tags; ++i)
+		{
+			if (names[i] < name_id)
+				continue;
+
+			return (names[i] == name_id) ? &packet->tag_value_ids[i] : nullptr;
+		}
+		return nullptr;
+	}
+
+	// lower bound
+	uint32_t lo = 0, hi = n_tags;
+	while (lo < hi)
+	{
+		uint32_t const mid = lo + (hi - lo) / 2;
+		if (names[mid] < name_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo < n_tags && names[lo] == name_id) ? &packet->tag_value_ids[lo] : nullptr;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 MEOW_DEFINE_SMART_ENUM(request_validate_result,
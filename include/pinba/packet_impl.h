@@ -109,7 +109,6 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 		uint8_t  status;
 		uint8_t  bloom_added;
 		uint32_t word_id;
-		uint64_t bloom_hashed;
 	};
 	name_id_t names_translated[r->n_dictionary];
 	memset(names_translated, 0, sizeof(names_translated)); // FIXME: can zerofill status only
@@ -129,13 +128,10 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 
 			nid.status += (nw != nullptr) + 1;
 			if (nid.status == name_id_t::ok)
-			{
-				nid.word_id      = nw->id;
-				nid.bloom_hashed = nw->id_hash;
-			}
+				nid.word_id = nw->id;
 		}
 
-		// ff::fmt(stderr, " -> {{ {0}, {1}, {2} }\n", nid.status, nid.word_id, nid.bloom_hashed);
+		// ff::fmt(stderr, " -> {{ {0}, {1} }\n", nid.status, nid.word_id);
 
 		return nid;
 	};
@@ -184,7 +180,7 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 	p->timer_count = r->n_timer_value;
 	if (p->timer_count > 0)
 	{
-		p->timers_blooms = (timer_bloom_t*)nmpa_alloc(nmpa, sizeof(timer_bloom_t) * r->n_timer_value);
+		p->timers_blooms = (timer_bloom_t*)nmpa_calloc(nmpa, sizeof(timer_bloom_t) * r->n_timer_value);
 		p->timers = (packed_timer_t*)nmpa_alloc(nmpa, sizeof(packed_timer_t) * r->n_timer_value);
 
 		// contiguous storage for all timer tag names/values
@@ -230,16 +226,14 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 
 				// packet and timer level blooms
 				{
-					// ff::fmt(stdout, "bloom add: [{0}] {1} -> {2}\n", d->get_word(tag_name_id), tag_name_id, td_hashed[tag_name_off]);
-
 					// always add tag name to timer bloom for current timer
-					p->timers_blooms[timer_i].add_hashed(nid.bloom_hashed);
+					p->timers_blooms[timer_i].add(nid.word_id);
 
 					// maybe also add to packet-level bloom, if we haven't already
 					if (0 == nid.bloom_added)
 					{
 						nid.bloom_added = 1;
-						p->bloom.add_hashed(nid.bloom_hashed);
+						p->bloom.add(nid.word_id);
 					}
 				}
 			}
@@ -271,6 +265,26 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, nameword_dicti
 			p->tag_name_ids[p->tag_count]  = nid.word_id;
 			p->tag_value_ids[p->tag_count] = vid.word_id;
 			p->tag_count++;
+
+			p->rtag_bloom.add(nid.word_id);
+		}
+
+		// sort tags by name, to make packet___find_request_tag() fast
+		// insertion sort is stable and tag count is usually small (and often already sorted)
+		for (unsigned i = 1; i < p->tag_count; i++)
+		{
+			uint32_t const name_id  = p->tag_name_ids[i];
+			uint32_t const value_id = p->tag_value_ids[i];
+
+			unsigned j = i;
+			for (; j > 0 && p->tag_name_ids[j-1] > name_id; j--)
+			{
+				p->tag_name_ids[j]  = p->tag_name_ids[j-1];
+				p->tag_value_ids[j] = p->tag_value_ids[j-1];
+			}
+
+			p->tag_name_ids[j]  = name_id;
+			p->tag_value_ids[j] = value_id;
 		}
 	}
 
@@ -304,6 +318,7 @@ inline SinkT& debug_dump_packet(SinkT& sink, packet_t *packet, dictionary_t *d,
 		packet->mem_used, packet->traffic);
 
 	ff::fmt(sink, "bloom: {0}\n", packet->bloom.to_string());
+	ff::fmt(sink, "rtag_bloom: {0}\n", packet->rtag_bloom.to_string());
 
 	for (unsigned i = 0; i < packet->tag_count; i++)
 	{
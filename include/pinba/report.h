@@ -18,6 +18,7 @@
 // #define HISTOGRAM_KIND__HASHTABLE  0
 #define HISTOGRAM_KIND__FLAT       1
 #define HISTOGRAM_KIND__HDR        2
+#define HISTOGRAM_KIND__SKETCH     3  // flat_histogram_t with sketch buckets, see histogram.h
 
 struct report_info_t
 {
@@ -35,6 +36,11 @@ struct report_info_t
 	uint32_t    hv_bucket_count;
 	duration_t  hv_bucket_d;
 	duration_t  hv_min_value;
+	duration_t  hv_unit_size;       // unit for aggregation histograms, 0 - same as hv_bucket_d
+	int         hv_precision_bits;  // precision for aggregation histograms, 0 - default
+	double      hv_sketch_alpha;    // relative error, for HISTOGRAM_KIND__SKETCH
+
+	bool        background_snapshot;  // report host prepares a fresh snapshot after every tick
 };
 
 // TODO: a lot of different threads modifying this struct
@@ -63,6 +69,7 @@ struct report_stats_t
 	std::atomic<uint64_t> packets_dropped_by_rfield   = {0}; // number of packets dropped by request_field aggregation
 	std::atomic<uint64_t> packets_dropped_by_rtag     = {0}; // number of packets dropped by request_tag aggregation
 	std::atomic<uint64_t> packets_dropped_by_timertag = {0}; // number of packets dropped by timer_tag aggregation (i.e. no useful timers)
+	std::atomic<uint64_t> packets_dropped_by_rtag_bloom = {0}; // number of packets dropped by request tag bloom (required request tags not present)
 
 	std::atomic<uint64_t> timers_scanned              = {0}; // number of timers scanned
 	std::atomic<uint64_t> timers_aggregated           = {0}; // number of timers that we took useful information from
@@ -161,6 +168,8 @@ struct report_snapshot_t
 	// as google::dense_hash_map has forward iterators only
 	// virtual position_t pos_prev(position_t const&) = 0;
 	virtual bool       pos_equal(position_t const&, position_t const&) const = 0;
+	// point lookup by full key (word ids), returns pos_last() if there is no such row
+	virtual position_t pos_find(report_key_t const&) = 0;
 
 	// key handling
 	virtual report_key_t     get_key(position_t const&) const = 0;
@@ -175,7 +184,9 @@ struct report_snapshot_t
 	virtual int   histogram_kind() const = 0;
 	virtual void* get_histogram(position_t const&) = 0;
 };
-typedef std::unique_ptr<report_snapshot_t> report_snapshot_ptr;
+// shared, since prepared snapshots are immutable and can be reused by concurrent selects
+// (see coordinator_t::get_report_snapshot_prepared())
+typedef std::shared_ptr<report_snapshot_t> report_snapshot_ptr;
 
 void debug_dump_report_snapshot(FILE*, report_snapshot_t*, str_ref name = {});
 
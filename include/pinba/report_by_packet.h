@@ -7,6 +7,7 @@
 
 #include "pinba/globals.h"
 #include "pinba/report.h"
+#include "pinba/packet.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -39,6 +40,10 @@ struct report_conf___by_packet_t
 	uint32_t    hv_bucket_count;  // number of histogram buckets, each bucket is hv_bucket_d 'wide'
 	duration_t  hv_bucket_d;      // width of each hv_bucket
 	duration_t  hv_min_value;     // lower bound time (upper_bound = min_time + bucket_d*bucket_count)
+	duration_t  hv_unit_size;     // hdr histogram unit (values are rounded up to it), 0 - same as hv_bucket_d
+	int         hv_precision_bits; // hdr histogram precision bits (7 = ~1%), 0 - default
+
+	bool        background_snapshot; // prepare snapshot in report thread after every tick, selects just take it
 
 public: // packet filtering
 
@@ -47,6 +52,7 @@ public: // packet filtering
 	{
 		std::string   name;
 		filter_func_t func;
+		uint32_t      rtag_name_id; // request tag name this filter requires (0 = none), goes to report's rtag bloom
 	};
 
 	std::vector<filter_descriptor_t> filters;
@@ -91,15 +97,10 @@ public: // packet filtering
 			.name    = ff::fmt_str("by_request_tag/{0}={1}", name_id, value_id),
 			.func = [=](packet_t *packet) -> bool
 			{
-				for (uint32_t i = 0; i < packet->tag_count; ++i)
-				{
-					if (packet->tag_name_ids[i] == name_id)
-					{
-						return (packet->tag_value_ids[i] == value_id);
-					}
-				}
-				return false;
+				uint32_t const *tag_value = packet___find_request_tag(packet, name_id);
+				return (tag_value != nullptr) && (*tag_value == value_id);
 			},
+			.rtag_name_id = name_id,
 		};
 	}
 
@@ -38,6 +38,11 @@ struct report_conf___by_request_t
 	uint32_t    hv_bucket_count;  // number of histogram buckets, each bucket is hv_bucket_d 'wide'
 	duration_t  hv_bucket_d;      // width of each hv_bucket
 	duration_t  hv_min_value;     // lower bound time (upper_bound = min_time + bucket_d*bucket_count)
+	duration_t  hv_unit_size;     // hdr histogram unit (values are rounded up to it), 0 - same as hv_bucket_d
+	int         hv_precision_bits; // hdr histogram precision bits (7 = ~1%), 0 - default
+	double      hv_sketch_alpha;  // > 0 - use quantile sketch with this relative error, instead of fixed width buckets
+
+	bool        background_snapshot; // prepare snapshot in report thread after every tick, selects just take it
 
 public: // packet filtering
 
@@ -46,6 +51,7 @@ public: // packet filtering
 	{
 		std::string   name;
 		filter_func_t func;
+		uint32_t      rtag_name_id; // request tag name this filter requires (0 = none), goes to report's rtag bloom
 	};
 
 	std::vector<filter_descriptor_t> filters;
@@ -90,15 +96,10 @@ public: // packet filtering
 			.name    = ff::fmt_str("by_request_tag/{0}={1}", name_id, value_id),
 			.func = [=](packet_t *packet) -> bool
 			{
-				for (uint32_t i = 0; i < packet->tag_count; ++i)
-				{
-					if (packet->tag_name_ids[i] == name_id)
-					{
-						return (packet->tag_value_ids[i] == value_id);
-					}
-				}
-				return false;
+				uint32_t const *tag_value = packet___find_request_tag(packet, name_id);
+				return (tag_value != nullptr) && (*tag_value == value_id);
 			},
+			.rtag_name_id = name_id,
 		};
 	}
 
@@ -116,6 +117,7 @@ public: // key fetchers, from packet fields and tags
 	{
 		std::string       name;
 		key_fetch_func_t  fetcher;
+		uint32_t          rtag_name_id; // request tag name this key is fetched from (0 = not a tag)
 	};
 
 	std::vector<key_descriptor_t> keys;
@@ -127,15 +129,13 @@ public: // key fetchers, from packet fields and tags
 			.name    = ff::fmt_str("request_tag/{0}", tag_name),
 			.fetcher = [=](packet_t *packet) -> key_fetch_result_t
 			{
-				for (uint32_t i = 0; i < packet->tag_count; ++i)
-				{
-					if (packet->tag_name_ids[i] == tag_name_id)
-					{
-						return { packet->tag_value_ids[i], true };
-					}
-				}
-				return { 0, false };
+				uint32_t const *tag_value = packet___find_request_tag(packet, tag_name_id);
+				if (tag_value == nullptr)
+					return { 0, false };
+
+				return { *tag_value, true };
 			},
+			.rtag_name_id = tag_name_id,
 		};
 	}
 
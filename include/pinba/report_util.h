@@ -1,12 +1,25 @@
 #ifndef PINBA__REPORT_UTIL_H_
 #define PINBA__REPORT_UTIL_H_
 
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 #include <utility>
 
+#include <boost/circular_buffer.hpp>
+
 #include <t1ha/t1ha.h>
+#include <tsl/robin_map.h>
 
 #include <meow/stopwatch.hpp>
 #include <meow/format/format_to_string.hpp>
@@ -111,6 +124,481 @@ std::string report_key_to_string(report_key_base_t<N> const& k, dictionary_t con
 	return result;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// hashtable, split into a fixed number of partitions by key hash
+// partitions are disjoint, so they can be modified in parallel, without any locking
+// iteration chains partitions one after another
+
+template<class KeyT, class ValueT>
+struct report_partitioned_map_t
+{
+	static constexpr uint32_t n_partitions = 16;
+
+	using partition_t = tsl::robin_map<
+							  KeyT
+							, ValueT
+							, report_key_impl___hasher_t
+							, report_key_impl___equal_t
+							, std::allocator<std::pair<KeyT, ValueT>>
+							, /*StoreHash=*/ true>;
+	using value_type  = typename partition_t::value_type;
+
+	// use high bits, robin_map takes bucket index from low ones
+	static inline uint32_t partition_for_hash(uint64_t key_hash)
+	{
+		return (key_hash >> 32) % n_partitions;
+	}
+
+	struct const_iterator
+	{
+		using iterator_category = std::forward_iterator_tag;
+		using value_type        = typename partition_t::value_type;
+		using difference_type   = std::ptrdiff_t;
+		using reference         = value_type const&;
+		using pointer           = value_type const*;
+
+		report_partitioned_map_t const        *map;
+		uint32_t                              partition;
+		typename partition_t::const_iterator  it;
+
+		reference operator*() const  { return *it; }
+		pointer   operator->() const { return &(*it); }
+
+		const_iterator& operator++()
+		{
+			++it;
+			this->skip_empty_partitions();
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator result = *this;
+			++(*this);
+			return result;
+		}
+
+		bool operator==(const_iterator const& other) const { return (partition == other.partition) && (it == other.it); }
+		bool operator!=(const_iterator const& other) const { return !(*this == other); }
+
+		void skip_empty_partitions()
+		{
+			while ((it == map->partitions_[partition].cend()) && (partition < (n_partitions - 1)))
+			{
+				partition++;
+				it = map->partitions_[partition].cbegin();
+			}
+		}
+	};
+
+public:
+
+	partition_t&       partition(uint32_t i)       { return partitions_[i]; }
+	partition_t const& partition(uint32_t i) const { return partitions_[i]; }
+
+	size_t size() const
+	{
+		size_t result = 0;
+		for (auto const& p : partitions_)
+			result += p.size();
+		return result;
+	}
+
+	size_t bucket_count() const
+	{
+		size_t result = 0;
+		for (auto const& p : partitions_)
+			result += p.bucket_count();
+		return result;
+	}
+
+	const_iterator begin() const
+	{
+		const_iterator result = { this, 0, partitions_[0].cbegin() };
+		result.skip_empty_partitions();
+		return result;
+	}
+
+	const_iterator end() const
+	{
+		return { this, n_partitions - 1, partitions_[n_partitions - 1].cend() };
+	}
+
+	const_iterator find(KeyT const& key) const
+	{
+		uint64_t const key_hash = report_key_impl___hasher_t()(key);
+		uint32_t const p        = partition_for_hash(key_hash);
+
+		auto const it = partitions_[p].find(key, key_hash);
+		if (it == partitions_[p].cend())
+			return this->end();
+
+		return { this, p, it };
+	}
+
+private:
+	std::array<partition_t, n_partitions> partitions_;
+};
+
+// persistent worker threads for merging partitions in parallel, owned by report history
+// workers are started on first use and kept until destruction, so that per-thread scratch buffers survive between ticks
+// not thread safe, parallel_for() must always be called from the same (report host) thread
+struct report_partitions_pool_t : private boost::noncopyable
+{
+	report_partitions_pool_t() = default;
+
+	~report_partitions_pool_t()
+	{
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+			shutdown_ = true;
+		}
+		job_cv_.notify_all();
+
+		for (auto& t : threads_)
+			t.join();
+	}
+
+	// run func(partition_index) for all partitions, spreading them between n_threads threads
+	// the calling thread takes its share of partitions as well
+	// returns after all threads are done, exception from any of them is rethrown here
+	template<class Function>
+	void parallel_for(uint32_t n_partitions, uint32_t n_threads, Function const& func)
+	{
+		n_threads = std::max<uint32_t>(1, std::min(n_threads, n_partitions));
+
+		auto const run_share = [&](uint32_t thread_id)
+		{
+			for (uint32_t i = thread_id; i < n_partitions; i += n_threads)
+				func(i);
+		};
+
+		if (n_threads == 1)
+		{
+			run_share(0);
+			return;
+		}
+
+		// start missing workers before any job is handed out, so that failure here leaves nothing running
+		// workers that did start are joined in destructor
+		while (threads_.size() < (n_threads - 1))
+		{
+			uint32_t const thread_id  = threads_.size() + 1;
+			uint64_t const generation = job_generation_; // only changed by this thread, safe to read unlocked
+			threads_.emplace_back([this, thread_id, generation]() { this->worker_loop(thread_id, generation); });
+		}
+
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+			job_func_      = run_share;
+			job_n_threads_ = n_threads;
+			job_pending_   = n_threads - 1;
+			job_error_     = nullptr;
+			job_generation_++;
+		}
+		job_cv_.notify_all();
+
+		// must wait for workers even if our share fails, they're using func and n_threads from this frame
+		std::exception_ptr error;
+		try
+		{
+			run_share(0);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+			done_cv_.wait(lk_, [this]() { return job_pending_ == 0; });
+
+			job_func_ = {};
+
+			if (!error)
+				error = job_error_;
+		}
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+
+	void worker_loop(uint32_t thread_id, uint64_t seen_generation)
+	{
+		std::unique_lock<std::mutex> lk_(mtx_);
+
+		while (true)
+		{
+			job_cv_.wait(lk_, [&]() { return shutdown_ || (job_generation_ != seen_generation); });
+
+			if (shutdown_)
+				return;
+
+			seen_generation = job_generation_;
+
+			// not needed for this job
+			if (thread_id >= job_n_threads_)
+				continue;
+
+			// job_func_ stays the same until all workers are done with it
+			lk_.unlock();
+
+			std::exception_ptr error;
+			try
+			{
+				job_func_(thread_id);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+
+			lk_.lock();
+
+			if (error && !job_error_)
+				job_error_ = error;
+
+			if (--job_pending_ == 0)
+				done_cv_.notify_one();
+		}
+	}
+
+private:
+	std::vector<std::thread>              threads_;
+
+	std::mutex                            mtx_;
+	std::condition_variable               job_cv_;              // workers wait for a new job or shutdown
+	std::condition_variable               done_cv_;             // caller waits for workers to finish the job
+	bool                                  shutdown_        = false;
+
+	uint64_t                              job_generation_  = 0; // bumped on every job
+	std::function<void(uint32_t)>         job_func_;            // func(thread_id)
+	uint32_t                              job_n_threads_   = 0;
+	uint32_t                              job_pending_     = 0; // workers still running current job
+	std::exception_ptr                    job_error_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// history window: all ticks in the history ring, merged into one partitioned map
+// rows of new ticks are added in merge_tick() and rows of evicted ticks are subtracted
+// snapshots share the map (see get_view()), and merge_tick() copies it, if it's still being used by some snapshot
+// big ticks are merged in parallel, every thread takes rows for its partitions only
+//
+// reports describe tick layout and row data arithmetic with Traits
+//
+// struct report_history_window_traits___example
+// {
+// 	using key_t  = ; // report_key_impl_t<N>
+// 	using data_t = ; // row data
+// 	using tick_t = ; // history tick, histograms are packed into its hv_arena member
+//
+// 	static size_t                     row_count(tick_t const&);
+// 	static uint64_t                   row_key_hash(tick_t const&, size_t i);
+// 	static key_t const&               row_key(tick_t const&, size_t i);
+// 	static data_t const&              row_data(tick_t const&, size_t i);
+// 	static packed_histogram_t const&  row_hv(tick_t const&, size_t i);      // only called with histograms enabled
+// 	static uint32_t                   row_n_ticks(tick_t const&, size_t i); // original ticks folded into row, 1 unless tick is a rollup
+//
+// 	static void data_add(data_t *to, data_t const& from);
+// 	static void data_subtract(data_t *to, data_t const& from);
+// };
+
+template<class Traits>
+struct report_history_window_t : private boost::noncopyable
+{
+	using traits_t = Traits;
+	using key_t    = typename Traits::key_t;
+	using data_t   = typename Traits::data_t;
+	using tick_t   = typename Traits::tick_t;
+
+	struct row_t
+	{
+		data_t            data;
+		flat_histogram_t  hv;
+		uint32_t          n_ticks;  // number of original ticks this key is present in, row is erased when this drops to 0
+	};
+
+	using map_t   = report_partitioned_map_t<key_t, row_t>;
+	using map_ptr = std::shared_ptr<map_t>;
+
+	// do not bother with merge threads for small ticks
+	static constexpr uint32_t parallel_merge_min_rows = 16 * 1024;
+
+	// map, as seen by a snapshot, stays the same after window changes
+	struct view_t
+	{
+		using iterator = typename map_t::const_iterator;
+
+		std::shared_ptr<map_t const> map;
+
+		iterator begin() const { return map->begin(); }
+		iterator end() const   { return map->end(); }
+		size_t   size() const  { return map->size(); }
+
+		iterator find(report_key_t const& k) const
+		{
+			static constexpr size_t n_key_parts = std::tuple_size<key_t>::value;
+
+			if (k.size() != n_key_parts)
+				return this->end();
+
+			key_t key;
+			std::copy_n(k.data(), n_key_parts, key.begin());
+
+			return map->find(key);
+		}
+	};
+
+public:
+
+	explicit report_history_window_t(bool hv_enabled)
+		: hv_enabled_(hv_enabled)
+		, map_(std::make_shared<map_t>())
+		, hv_values_()
+	{
+	}
+
+	// add new tick rows and subtract evicted tick rows, evicted_tick is nullptr if nothing has been evicted
+	// ticks with at least parallel_merge_min_rows rows (together) are merged with n_merge_threads threads
+	void merge_tick(tick_t const& new_tick, tick_t const *evicted_tick, uint32_t n_merge_threads)
+	{
+		size_t const   n_rows    = Traits::row_count(new_tick) + ((evicted_tick) ? Traits::row_count(*evicted_tick) : 0);
+		uint32_t const n_threads = (n_rows >= parallel_merge_min_rows) ? n_merge_threads : 1;
+
+		map_t& map = this->map_for_update(n_threads);
+
+		// add new rows first, so that rows present in both ticks are not erased and re-inserted
+		if (n_threads <= 1)
+		{
+			for (size_t i = 0, n = Traits::row_count(new_tick); i < n; i++)
+				this->add_row(map, map_t::partition_for_hash(Traits::row_key_hash(new_tick, i)), new_tick, i);
+
+			if (evicted_tick)
+			{
+				for (size_t i = 0, n = Traits::row_count(*evicted_tick); i < n; i++)
+					this->subtract_row(map, map_t::partition_for_hash(Traits::row_key_hash(*evicted_tick, i)), *evicted_tick, i);
+			}
+			return;
+		}
+
+		merge_pool_.parallel_for(map_t::n_partitions, n_threads, [&](uint32_t p)
+		{
+			for (size_t i = 0, n = Traits::row_count(new_tick); i < n; i++)
+			{
+				if (map_t::partition_for_hash(Traits::row_key_hash(new_tick, i)) == p)
+					this->add_row(map, p, new_tick, i);
+			}
+
+			if (!evicted_tick)
+				return;
+
+			for (size_t i = 0, n = Traits::row_count(*evicted_tick); i < n; i++)
+			{
+				if (map_t::partition_for_hash(Traits::row_key_hash(*evicted_tick, i)) == p)
+					this->subtract_row(map, p, *evicted_tick, i);
+			}
+		});
+	}
+
+	// window is always up to date, so this is exact
+	size_t row_count() const
+	{
+		return map_->size();
+	}
+
+	uint64_t mem_used() const
+	{
+		uint64_t result = map_->bucket_count() * sizeof(typename map_t::value_type);
+
+		for (auto const hv_values : hv_values_)
+			result += hv_values * sizeof(histogram_value_t);
+
+		return result;
+	}
+
+	view_t get_view() const
+	{
+		return view_t { map_ };
+	}
+
+private:
+
+	map_t& map_for_update(uint32_t n_threads)
+	{
+		// some snapshot is still holding the map, copy
+		// this is the only thread that can add refs, so unique() is reliable here
+		if (!map_.unique())
+		{
+			auto const& src = *map_;
+			auto        dst = std::make_shared<map_t>();
+
+			merge_pool_.parallel_for(map_t::n_partitions, n_threads, [&](uint32_t p)
+			{
+				dst->partition(p) = src.partition(p);
+			});
+
+			map_ = std::move(dst);
+		}
+
+		return *map_;
+	}
+
+	void add_row(map_t& map, uint32_t p, tick_t const& tick, size_t i)
+	{
+		auto inserted_pair = map.partition(p).emplace_hash(Traits::row_key_hash(tick, i), Traits::row_key(tick, i), row_t{});
+		row_t&         dst = inserted_pair.first.value();
+
+		dst.n_ticks += Traits::row_n_ticks(tick, i);
+
+		Traits::data_add(&dst.data, Traits::row_data(tick, i));
+
+		if (hv_enabled_)
+		{
+			hv_values_[p] -= dst.hv.values.size();
+			histogram___flat_add(&dst.hv, tick.hv_arena, Traits::row_hv(tick, i));
+			hv_values_[p] += dst.hv.values.size();
+		}
+	}
+
+	void subtract_row(map_t& map, uint32_t p, tick_t const& tick, size_t i)
+	{
+		auto& partition = map.partition(p);
+
+		auto it = partition.find(Traits::row_key(tick, i), Traits::row_key_hash(tick, i));
+		assert(it != partition.end()); // every row in the ring must have been added to window
+
+		row_t&         dst     = it.value();
+		uint32_t const n_ticks = Traits::row_n_ticks(tick, i);
+		assert(dst.n_ticks >= n_ticks);
+
+		dst.n_ticks -= n_ticks;
+		if (dst.n_ticks == 0)
+		{
+			hv_values_[p] -= dst.hv.values.size();
+			partition.erase(it);
+			return;
+		}
+
+		Traits::data_subtract(&dst.data, Traits::row_data(tick, i));
+
+		if (hv_enabled_)
+		{
+			hv_values_[p] -= dst.hv.values.size();
+			histogram___flat_subtract(&dst.hv, tick.hv_arena, Traits::row_hv(tick, i));
+			hv_values_[p] += dst.hv.values.size();
+		}
+	}
+
+private:
+	bool                                        hv_enabled_;
+	map_ptr                                     map_;
+	std::array<uint64_t, map_t::n_partitions>   hv_values_;   // total histogram values in partitions, for mem estimates
+
+	report_partitions_pool_t                    merge_pool_;  // see options()->report_merge_threads
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct nmpa_autofree_t : public nmpa_s
@@ -140,7 +628,7 @@ struct nmpa_autofree_t : public nmpa_s
 /*
 struct report_snapshot_traits___example
 {
-	using src_ticks_t = ; // source ticks_ringbuffer_t
+	using src_ticks_t = ; // source ticks, usually report_ticks_view_t
 	using hashtable_t = ; // result hashtable (that we're going to iterate over)
 	using totals_t    = ; // struct, holding merged report data totals
 
@@ -167,6 +655,9 @@ struct report_snapshot_traits___example
 	static report_key_t key_at_position(hashtable_t const&, iterator_t const&);
 	static void*        value_at_position(hashtable_t const&, iterator_t const&);
 	static histogram_t* hv_at_position(hashtable_t const&, iterator_t const&);
+
+	// find row by full key, returns end() if there is no such row
+	static iterator_t   find_key(hashtable_t const&, report_key_t const&);
 };
 */
 
@@ -241,6 +732,16 @@ public:
 	{
 	}
 
+	// for reports that keep data merged in advance and only need to share it with the snapshot
+	report_snapshot__impl_t(report_snapshot_ctx_t ctx, src_ticks_t const& ticks, hashtable_t const& data)
+		: report_snapshot_ctx_t(ctx)
+		, data_(data)
+		, ticks_(ticks)
+		, snap_d_(ctx.globals->dictionary())
+		, prepared_(false)
+	{
+	}
+
 private:
 
 	virtual report_info_t const* report_info() const override
@@ -371,6 +872,11 @@ private:
 		return (l_it == r_it);
 	}
 
+	virtual position_t pos_find(report_key_t const& key) override
+	{
+		return position_from_iterator(Traits::find_key(data_, key));
+	}
+
 	virtual report_key_t get_key(position_t const& pos) const override
 	{
 		auto const& it = iterator_from_position(pos);
@@ -422,6 +928,66 @@ private:
 	}
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// snapshot traits for reports with history window (see report_history_window_t)
+// window has merged all the data already, snapshot just iterates over its view
+// reports derive from this and add src_ticks_t, totals_t and calculate_totals()
+
+template<class WindowT>
+struct report_history_window___snapshot_traits_t
+{
+	using hashtable_t = typename WindowT::view_t;
+	using iterator_t  = typename hashtable_t::iterator;
+	using tick_t      = typename WindowT::tick_t;
+
+	static report_key_t key_at_position(hashtable_t const&, iterator_t const& it)
+	{
+		return report_key_t { it->first };
+	}
+
+	static void* value_at_position(hashtable_t const&, iterator_t const& it)
+	{
+		return (void*)&it->second.data;
+	}
+
+	static void* hv_at_position(hashtable_t const&, iterator_t const& it)
+	{
+		return (void*)&it->second.hv;
+	}
+
+	static iterator_t find_key(hashtable_t const& ht, report_key_t const& k)
+	{
+		return ht.find(k);
+	}
+
+	template<class SrcTicks>
+	static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, SrcTicks const& ticks, report_raw_stats_t *stats)
+	{
+		for (auto const& tick_base : ticks)
+		{
+			if (!tick_base)
+				continue;
+
+			stats->row_count += WindowT::traits_t::row_count(static_cast<tick_t const&>(*tick_base));
+		}
+	}
+
+	// data has been merged by history already, nothing to do here
+	template<class SrcTicks>
+	static void merge_ticks_into_data(
+		  report_snapshot_ctx_t *snapshot_ctx
+		, SrcTicks& ticks
+		, hashtable_t& to
+		, report_snapshot_t::merge_flags_t flags)
+	{
+		LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, window rows: {2}",
+			snapshot_ctx->rinfo.name, ticks.size(), to.size());
+
+		// repacker state has been taken by the snapshot, and window holds all the data we need
+		ticks.clear();
+	}
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 template<class T>
@@ -450,12 +1016,13 @@ struct ticks_ringbuffer_t : private boost::noncopyable
 	};
 
 	using tick_ptr     = std::shared_ptr<tick_t>;
-	using ringbuffer_t = std::vector<tick_ptr>;
+	using ringbuffer_t = boost::circular_buffer<tick_ptr>;
 
 public:
 
 	ticks_ringbuffer_t(uint32_t tick_count)
 		: tick_count_(tick_count)
+		, ticks_(tick_count)
 	{
 	}
 
@@ -471,14 +1038,8 @@ public:
 	{
 		curr_tick_->end_tv = curr_tv;           // finish current tick
 
-		ticks_.push_back(curr_tick_);           // copy tick to history
+		ticks_.push_back(curr_tick_);           // copy tick to history, overwrites the oldest one, if full
 		curr_tick_.reset(new tick_t(curr_tv));  // and create new tick at 'current'
-
-		// maybe truncate history, if it has grown too long
-		if (ticks_.size() >  tick_count_)
-		{
-			ticks_.erase(ticks_.begin()); // XXX: O(N)
-		}
 	}
 
 	ringbuffer_t const& get_internal_buffer() const
@@ -502,16 +1063,115 @@ private:
 	tick_ptr      curr_tick_;
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// free list of aggregator ticks, history gives ticks back once it has converted them
+// so that aggregator reuses their memory pools and containers, instead of allocating from scratch every tick
+// aggregator and history might live in different threads, lock is taken a couple of times per tick only
+//
+// TickT must have reset(), dropping all data but keeping the memory
+
+template<class TickT>
+struct report_tick_pool_t : private boost::noncopyable
+{
+	using tick_ptr = boost::intrusive_ptr<TickT>;
+
+	// history converts ticks right after they've been produced, so a couple is enough
+	static constexpr size_t max_free_ticks = 2;
+
+public:
+
+	// recycled tick or a new one
+	tick_ptr get()
+	{
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			if (!free_ticks_.empty())
+			{
+				tick_ptr result = std::move(free_ticks_.back());
+				free_ticks_.pop_back();
+				return result;
+			}
+		}
+
+		return meow::make_intrusive<TickT>();
+	}
+
+	// take tick back, unless someone else is still holding it
+	void put(report_tick_ptr tick_base)
+	{
+		if (!tick_base || (tick_base->use_count() != 1))
+			return;
+
+		tick_ptr tick { static_cast<TickT*>(tick_base.get()) };
+		tick_base.reset();
+
+		tick->reset(); // without the lock, might take a while for big ticks
+
+		std::lock_guard<std::mutex> lk_(mtx_);
+
+		if (free_ticks_.size() < max_free_ticks)
+			free_ticks_.emplace_back(std::move(tick));
+	}
+
+private:
+	std::mutex             mtx_;
+	std::vector<tick_ptr>  free_ticks_;
+};
+
+// prepare (empty) hashtable for a tick, that is expected to have about the same number of rows as the previous one
+// buckets are kept, unless there are way too many of them (i.e. after a spike)
+template<class HashtableT>
+inline void report_hashtable___presize(HashtableT& ht, size_t expected_rows)
+{
+	if (ht.bucket_count() > 4 * std::max<size_t>(expected_rows, 64))
+		ht.rehash(0);
+
+	ht.reserve(expected_rows);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// immutable list of history ticks (oldest first), shared between history and snapshots
+// history builds it once after every change, so that taking snapshots does not copy tick lists
+
+struct report_ticks_view_t
+{
+	using ticks_t        = std::vector<report_tick_ptr>;
+	using const_iterator = ticks_t::const_iterator;
+
+	std::shared_ptr<ticks_t const> ticks_ptr;
+
+public:
+
+	ticks_t const& ticks() const
+	{
+		static ticks_t const empty = {};
+		return (ticks_ptr) ? *ticks_ptr : empty;
+	}
+
+	const_iterator begin() const { return this->ticks().begin(); }
+	const_iterator end() const   { return this->ticks().end(); }
+	size_t         size() const  { return this->ticks().size(); }
+	bool           empty() const { return this->ticks().empty(); }
+
+	// drop the ref, ticks stay alive while history or other snapshots need them
+	void clear()
+	{
+		ticks_ptr.reset();
+	}
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct report_history_ringbuffer_t : private boost::noncopyable
 {
-	using ringbuffer_t = std::vector<report_tick_ptr>;
+	using ringbuffer_t = boost::circular_buffer<report_tick_ptr>;
+	using view_t       = report_ticks_view_t;
 
 public:
 
 	report_history_ringbuffer_t(uint32_t max_ticks)
-		: max_ticks_(max_ticks)
+		: ringbuffer_(max_ticks)
 	{
 	}
 
@@ -519,24 +1179,191 @@ public:
 	{
 		report_tick_ptr result = {};
 
-		ringbuffer_.emplace_back(std::move(tick));
-		if (ringbuffer_.size() > max_ticks_)
+		if (ringbuffer_.full())
+		{
+			result = std::move(ringbuffer_.front());
+			ringbuffer_.pop_front();
+		}
+
+		ringbuffer_.push_back(std::move(tick));
+		view_.clear();
+
+		return result;
+	}
+
+	view_t const& get_view() const
+	{
+		if (!view_.ticks_ptr)
+			view_.ticks_ptr = std::make_shared<view_t::ticks_t>(ringbuffer_.begin(), ringbuffer_.end());
+
+		return view_;
+	}
+
+private:
+	ringbuffer_t    ringbuffer_;
+	mutable view_t  view_;       // built on demand, reset on every change
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// tick history, with older ticks folded into coarser 'rollup' ticks, to keep long histories cheap
+// tier 0 keeps ticks as they come, every next tier keeps rollups of a fixed number of previous tier ticks
+// previous tier ticks wait in 'pending' list, until there is enough of them to fold
+// rollups are evicted from the last tier, once number of original ticks covered exceeds max_ticks
+// so history covers between (max_ticks - last tier fold + 1) and max_ticks original ticks
+// (per_sec values are still calculated over full time_window, so they dip by up to one fold after eviction)
+
+struct report_history_tiers_t : private boost::noncopyable
+{
+	using ringbuffer_t = boost::circular_buffer<report_tick_ptr>;
+	using view_t       = report_ticks_view_t;
+
+	struct tier_conf_t
+	{
+		uint32_t fold;      // number of original ticks in one tick of this tier
+		uint32_t capacity;  // max ticks in this tier, ignored for the last tier (bounded by max_ticks)
+	};
+	using tier_conf_v_t = std::vector<tier_conf_t>;
+
+	// short histories are kept as is
+	// longer ones keep last 60 ticks as is, then 10 tick rollups, then 60 tick rollups for really long ones
+	// NOTE: all tiers but the last must cover less than max_ticks, as we evict from the last tier only
+	static tier_conf_v_t default_tiers(uint32_t max_ticks)
+	{
+		if (max_ticks <= 120)
+			return { { .fold = 1, .capacity = max_ticks } };
+
+		if (max_ticks <= 1200)
+			return { { .fold = 1, .capacity = 60 }, { .fold = 10, .capacity = 0 } };
+
+		return { { .fold = 1, .capacity = 60 }, { .fold = 10, .capacity = 54 }, { .fold = 60, .capacity = 0 } };
+	}
+
+public:
+
+	explicit report_history_tiers_t(uint32_t max_ticks)
+		: report_history_tiers_t(max_ticks, default_tiers(max_ticks))
+	{
+	}
+
+	report_history_tiers_t(uint32_t max_ticks, tier_conf_v_t const& tiers_conf)
+		: max_ticks_(max_ticks)
+		, total_span_(0)
+	{
+		for (size_t i = 0; i < tiers_conf.size(); i++)
+		{
+			bool const is_last = (i == (tiers_conf.size() - 1));
+
+			tiers_.emplace_back();
+
+			tier_t& tier = tiers_.back();
+			tier.conf = tiers_conf[i];
+
+			// +1 for the tick that is appended before the oldest one is moved out
+			// last tier might get one extra rollup, before eviction kicks in
+			uint32_t const capacity = (is_last)
+					? (max_ticks / tier.conf.fold + 2)
+					: (tier.conf.capacity + 1);
+
+			tier.ticks.set_capacity(capacity);
+		}
+	}
+
+	// append new tick, folding older ticks with rollup_func as needed, returns evicted tick (if any)
+	// report_tick_ptr rollup_func(report_tick_ptr const *ticks, uint32_t n_ticks) - merge ticks into a new one
+	template<class RollupFunction>
+	report_tick_ptr append(report_tick_ptr tick, RollupFunction const& rollup_func)
+	{
+		total_span_ += 1;
+		view_.clear();
+
+		report_tick_ptr moving = std::move(tick);
+
+		for (size_t i = 0; i < tiers_.size(); i++)
+		{
+			tier_t& tier = tiers_[i];
+
+			// previous tier tick, wait until we have enough to fold
+			if (i > 0)
+			{
+				tier.pending.emplace_back(std::move(moving));
+
+				uint32_t const n_fold = tier.conf.fold / tiers_[i - 1].conf.fold;
+				if (tier.pending.size() < n_fold)
+					break;
+
+				moving = rollup_func(tier.pending.data(), (uint32_t)tier.pending.size());
+				tier.pending.clear();
+			}
+
+			// must never overwrite anything silently
+			if (tier.ticks.full())
+				tier.ticks.set_capacity(tier.ticks.capacity() * 2);
+
+			tier.ticks.push_back(std::move(moving));
+
+			bool const is_last = (i == (tiers_.size() - 1));
+			if (is_last || (tier.ticks.size() <= tier.conf.capacity))
+				break;
+
+			moving = std::move(tier.ticks.front());
+			tier.ticks.pop_front();
+		}
+
+		report_tick_ptr result = {};
+
+		tier_t& last = tiers_.back();
+		if ((total_span_ > max_ticks_) && !last.ticks.empty())
 		{
-			result = std::move(*ringbuffer_.begin());
-			ringbuffer_.erase(ringbuffer_.begin()); // XXX: O(n)
+			result = std::move(last.ticks.front());
+			last.ticks.pop_front();
+
+			total_span_ -= last.conf.fold;
 		}
 
 		return result;
 	}
 
-	ringbuffer_t const& get_ringbuffer() const
+	// all ticks, oldest first
+	view_t const& get_view() const
 	{
-		return ringbuffer_;
+		if (view_.ticks_ptr)
+			return view_;
+
+		auto ticks = std::make_shared<view_t::ticks_t>();
+		ticks->reserve(this->size());
+
+		for (auto tier_it = tiers_.rbegin(); tier_it != tiers_.rend(); ++tier_it)
+		{
+			ticks->insert(ticks->end(), tier_it->ticks.begin(), tier_it->ticks.end());
+			ticks->insert(ticks->end(), tier_it->pending.begin(), tier_it->pending.end());
+		}
+
+		view_.ticks_ptr = std::move(ticks);
+		return view_;
+	}
+
+	size_t size() const
+	{
+		size_t result = 0;
+		for (auto const& tier : tiers_)
+			result += tier.ticks.size() + tier.pending.size();
+		return result;
 	}
 
 private:
-	uint32_t      max_ticks_;
-	ringbuffer_t  ringbuffer_;
+
+	struct tier_t
+	{
+		tier_conf_t                   conf;
+		ringbuffer_t                  ticks;    // oldest first
+		std::vector<report_tick_ptr>  pending;  // previous tier ticks, waiting to be folded into one of ours
+	};
+
+	uint32_t             max_ticks_;
+	uint32_t             total_span_;  // original ticks covered by all tiers
+	std::vector<tier_t>  tiers_;
+
+	mutable view_t       view_;        // built on demand, reset on every change
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -549,12 +1376,25 @@ inline histogram_conf_t histogram___configure_with_rinfo(report_info_t const& ri
 	histogram_conf_t hv_conf = {
 		.min_value      = rinfo.hv_min_value,
 		.max_value      = rinfo.hv_min_value + (rinfo.hv_bucket_count * rinfo.hv_bucket_d),
-		.unit_size      = rinfo.hv_bucket_d, // NOTE: if you change this to be != bucket_d, fix conversion hdr -> flat
-		.precision_bits = 7,
+		.unit_size      = (rinfo.hv_unit_size.nsec > 0) ? rinfo.hv_unit_size : rinfo.hv_bucket_d,
+		.precision_bits = (rinfo.hv_precision_bits > 0) ? rinfo.hv_precision_bits : 7,
 		.bucket_d       = rinfo.hv_bucket_d,
 		.hdr            = {},
 	};
 
+	// sketch buckets are computed from hdr values at tick end, see histogram___pack_hdr_as_sketch()
+	// so hdr must be precise enough, and in fixed units (as sketch bucket ids depend on them)
+	if (HISTOGRAM_KIND__SKETCH == rinfo.hv_kind)
+	{
+		hv_conf.unit_size       = d_microsecond;
+		hv_conf.bucket_d        = d_microsecond;
+		hv_conf.precision_bits  = (rinfo.hv_precision_bits > 0)
+									? rinfo.hv_precision_bits
+									: histogram___sketch_hdr_precision_bits(rinfo.hv_sketch_alpha);
+		hv_conf.sketch_alpha    = rinfo.hv_sketch_alpha;
+		hv_conf.sketch_ln_gamma = histogram___sketch_ln_gamma(rinfo.hv_sketch_alpha);
+	}
+
 	auto const err = hdr_histogram_configure(&hv_conf.hdr, hv_conf);
 	if (err)
 		throw std::runtime_error(ff::fmt_str("bad histogram config: {0}", err));
@@ -0,0 +1,120 @@
+#ifndef PINBA__SIMD_FIND_H_
+#define PINBA__SIMD_FIND_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <immintrin.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace pinba {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// values to look for with find_u32_multi(), padded to a whole number of avx2 registers
+	// used to match timer tag names against all tag names a report needs (filters and keys)
+	struct find_u32_needles_t
+	{
+		static constexpr uint32_t lanes = 8;
+
+		std::vector<uint32_t> ids;      // padded with copies of the last needle, matches on padding are dropped
+		uint32_t              size = 0; // real needles count
+
+		void push_back(uint32_t id)
+		{
+			ids.resize(size);
+			ids.push_back(id);
+			size += 1;
+
+			ids.resize(((size + lanes - 1) / lanes) * lanes, id);
+		}
+	};
+
+	// avx2 is used when cpu supports it, sse4 is the baseline (we build with -msse4.2, see configure.ac)
+	inline bool find_u32___use_avx2()
+	{
+		static bool const use_avx2 = []()
+		{
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+		}();
+
+		return use_avx2;
+	}
+
+	// every value is compared against all needles at once, matches are reported in value order
+	// bool func(uint32_t value_i, uint32_t needle_i), return false to stop
+	// returns false if stopped by func, true otherwise
+	template<class Function>
+	inline bool find_u32_multi___sse4(uint32_t const *values, uint32_t n_values, find_u32_needles_t const& needles, Function const& func)
+	{
+		uint32_t const *ids = needles.ids.data();
+
+		for (uint32_t i = 0; i < n_values; ++i)
+		{
+			__m128i const v = _mm_set1_epi32(values[i]);
+
+			for (uint32_t c = 0; c < needles.size; c += 4)
+			{
+				__m128i const n    = _mm_loadu_si128((__m128i const*)(ids + c));
+				uint32_t      mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, n)));
+
+				for (; mask != 0; mask &= mask - 1)
+				{
+					uint32_t const needle_i = c + __builtin_ctz(mask);
+					if (needle_i >= needles.size)
+						break;
+
+					if (!func(i, needle_i))
+						return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	template<class Function>
+	__attribute__((target("avx2")))
+	inline bool find_u32_multi___avx2(uint32_t const *values, uint32_t n_values, find_u32_needles_t const& needles, Function const& func)
+	{
+		uint32_t const *ids = needles.ids.data();
+
+		for (uint32_t i = 0; i < n_values; ++i)
+		{
+			__m256i const v = _mm256_set1_epi32(values[i]);
+
+			for (uint32_t c = 0; c < needles.size; c += 8)
+			{
+				__m256i const n    = _mm256_loadu_si256((__m256i const*)(ids + c));
+				uint32_t      mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, n)));
+
+				for (; mask != 0; mask &= mask - 1)
+				{
+					uint32_t const needle_i = c + __builtin_ctz(mask);
+					if (needle_i >= needles.size)
+						break;
+
+					if (!func(i, needle_i))
+						return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// single pass over values, calling func(value_i, needle_i) for every values[value_i] == needles[needle_i]
+	template<class Function>
+	inline bool find_u32_multi(uint32_t const *values, uint32_t n_values, find_u32_needles_t const& needles, Function const& func)
+	{
+		if (find_u32___use_avx2())
+			return find_u32_multi___avx2(values, n_values, needles, func);
+
+		return find_u32_multi___sse4(values, n_values, needles, func);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace pinba {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__SIMD_FIND_H_
@@ -0,0 +1,50 @@
+#ifndef PINBA__SIMD_HISTOGRAM_H_
+#define PINBA__SIMD_HISTOGRAM_H_
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace pinba {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// dst[i] += src[i], returns the number of dst counters that were zero and became nonzero
+	// used to merge dense hdr histogram counts
+	using add_counts_u32_func_t = uint32_t (*)(uint32_t *dst, uint32_t const *src, uint32_t size);
+
+	uint32_t add_counts_u32___scalar(uint32_t *dst, uint32_t const *src, uint32_t size);
+	uint32_t add_counts_u32___sse4(uint32_t *dst, uint32_t const *src, uint32_t size);  // 4 counters per add
+	uint32_t add_counts_u32___avx2(uint32_t *dst, uint32_t const *src, uint32_t size);  // 8 counters per add
+
+	// writes positions of nonzero values to positions (must have room for size items), returns their number
+	// used to walk dense hdr histogram counts, which are mostly zeroes
+	using find_nonzero_u32_func_t = uint32_t (*)(uint32_t const *values, uint32_t size, uint32_t *positions);
+
+	uint32_t find_nonzero_u32___scalar(uint32_t const *values, uint32_t size, uint32_t *positions);
+	uint32_t find_nonzero_u32___sse4(uint32_t const *values, uint32_t size, uint32_t *positions);
+	uint32_t find_nonzero_u32___avx2(uint32_t const *values, uint32_t size, uint32_t *positions); // skips 32 zeroes per test
+
+	// best implementations for the cpu we're running on
+	// sse4 is the baseline (we build with -msse4.2, see configure.ac), avx2 is used when cpu supports it
+	// resolved on first use, so it's safe to call these from static initializers as well
+	struct simd_histogram_impl_t
+	{
+		add_counts_u32_func_t    add_counts;
+		find_nonzero_u32_func_t  find_nonzero;
+	};
+	simd_histogram_impl_t const& simd_histogram___best();
+
+	inline uint32_t add_counts_u32(uint32_t *dst, uint32_t const *src, uint32_t size)
+	{
+		return simd_histogram___best().add_counts(dst, src, size);
+	}
+
+	inline uint32_t find_nonzero_u32(uint32_t const *values, uint32_t size, uint32_t *positions)
+	{
+		return simd_histogram___best().find_nonzero(values, size, positions);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace pinba {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__SIMD_HISTOGRAM_H_
@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <cmath>    // llround
+#include <string>
 #include <type_traits>
 
 #include "mysql_engine/handler.h"
 #include "mysql_engine/plugin.h"
 
 #include "pinba/globals.h"
+#include "pinba/dictionary.h"
 #include "pinba/histogram.h"
 #include "pinba/report_by_request.h"
 #include "pinba/report_by_timer.h"
@@ -14,10 +18,14 @@
 #ifdef PINBA_USE_MYSQL_SOURCE
 #include <sql/field.h> // <mysql/private/field.h>
 #include <sql/handler.h> // <mysql/private/handler.h>
+#include <sql/key.h> // <mysql/private/key.h>
+#include <sql/item_cmpfunc.h> // <mysql/private/item_cmpfunc.h>
 #include <include/mysqld_error.h> // <mysql/mysqld_error.h>
 #else
 #include <mysql/private/field.h>
 #include <mysql/private/handler.h>
+#include <mysql/private/key.h>
+#include <mysql/private/item_cmpfunc.h>
 #include <mysql/mysqld_error.h>
 #endif // PINBA_USE_MYSQL_SOURCE
 
@@ -59,6 +67,175 @@
 	}; break;                                                      \
 /**/
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// raw histogram field writers
+// both get begin(n_values, negative_inf, positive_inf), then value(bucket_id, count) n_values times, then end()
+
+namespace { namespace aux {
+
+	// decimal integer, without going through format machinery, this is called for every histogram bucket
+	inline void hv_append_uint(std::string& out, uint64_t v)
+	{
+		char buf[20];
+		char *p = buf + sizeof(buf);
+
+		do {
+			*--p = '0' + (v % 10);
+			v /= 10;
+		} while (v != 0);
+
+		out.append(p, buf + sizeof(buf) - p);
+	}
+
+	// hv=<min_ms>:<max_ms>:<bucket_count>;values=[<bucket_id>:<count>, ..., min:<negative_inf>, max:<positive_inf>]
+	struct hv_text_writer_t
+	{
+		std::string&  out;
+		str_ref       kv_separator;
+		uint32_t      negative_inf;
+		uint32_t      positive_inf;
+		bool          has_values;
+
+		void begin(report_info_t const *rinfo, uint32_t n_values, uint32_t neg_inf, uint32_t pos_inf)
+		{
+			uint32_t const hv_min_ms = (rinfo->hv_min_value / d_millisecond).nsec;
+			uint32_t const hv_max_ms = hv_min_ms + ((rinfo->hv_bucket_count * rinfo->hv_bucket_d) / d_millisecond).nsec;
+
+			if (HISTOGRAM_KIND__SKETCH == rinfo->hv_kind)
+				ff::fmt(out, "sketch={0}:{1}:{2};", rinfo->hv_sketch_alpha, hv_min_ms, hv_max_ms);
+			else
+				ff::fmt(out, "hv={0}:{1}:{2};", hv_min_ms, hv_max_ms, rinfo->hv_bucket_count);
+
+			out.append("values=[");
+			out.reserve(out.size() + n_values * 16);
+
+			negative_inf = neg_inf;
+			positive_inf = pos_inf;
+			has_values   = false;
+		}
+
+		void value(uint64_t bucket_id, uint32_t count)
+		{
+			if (has_values)
+				out.append(", ");
+
+			hv_append_uint(out, bucket_id);
+			out.append(kv_separator.data(), kv_separator.size());
+			hv_append_uint(out, count);
+
+			has_values = true;
+		}
+
+		void end()
+		{
+			if (negative_inf > 0)
+			{
+				out.append(has_values ? ", min:" : "min:");
+				hv_append_uint(out, negative_inf);
+				has_values = true;
+			}
+
+			if (positive_inf > 0)
+			{
+				out.append(has_values ? ", max:" : "max:");
+				hv_append_uint(out, positive_inf);
+			}
+
+			out.append("]");
+		}
+	};
+
+	// see README, 'Binary histogram output format', and scripts/decode_histogram.py
+	struct hv_binary_writer_t
+	{
+		static constexpr uint8_t format_version = 1;
+
+		std::string&  out;
+		uint64_t      prev_bucket_id;
+
+		void put_varint(uint64_t v)
+		{
+			char buf[10];
+			char *p = buf;
+
+			while (v >= 0x80)
+			{
+				*p++ = (char)(v | 0x80);
+				v >>= 7;
+			}
+			*p++ = (char)v;
+
+			out.append(buf, p - buf);
+		}
+
+		void begin(report_info_t const *rinfo, uint32_t n_values, uint32_t neg_inf, uint32_t pos_inf)
+		{
+			uint32_t const hv_min_ms = (rinfo->hv_min_value / d_millisecond).nsec;
+			uint32_t const hv_max_ms = hv_min_ms + ((rinfo->hv_bucket_count * rinfo->hv_bucket_d) / d_millisecond).nsec;
+
+			out.reserve(out.size() + 32 + n_values * 4);
+
+			out.push_back((char)format_version);
+			out.push_back((char)rinfo->hv_kind);
+			put_varint(hv_min_ms);
+			put_varint(hv_max_ms);
+			put_varint(rinfo->hv_bucket_count);
+
+			if (HISTOGRAM_KIND__SKETCH == rinfo->hv_kind)
+				put_varint((uint64_t)std::llround(rinfo->hv_sketch_alpha * 1000000)); // millionths
+
+			put_varint(neg_inf);
+			put_varint(pos_inf);
+			put_varint(n_values);
+
+			prev_bucket_id = 0;
+		}
+
+		void value(uint64_t bucket_id, uint32_t count)
+		{
+			put_varint(bucket_id - prev_bucket_id);
+			put_varint(count);
+			prev_bucket_id = bucket_id;
+		}
+
+		void end()
+		{
+		}
+	};
+
+	template<class Writer>
+	inline void hv_write(Writer& w, report_info_t const *rinfo, void const *histogram)
+	{
+		// sketch is a flat histogram too, just bucket ids have different meaning
+		if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind || HISTOGRAM_KIND__SKETCH == rinfo->hv_kind)
+		{
+			auto const *hv = static_cast<flat_histogram_t const*>(histogram);
+
+			w.begin(rinfo, hv->values.size(), hv->negative_inf, hv->positive_inf);
+
+			for (auto const& item : hv->values)
+				w.value(item.bucket_id, item.value);
+
+			w.end();
+		}
+
+		if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+		{
+			auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
+
+			w.begin(rinfo, hv->counts_nonzero(), hv->negative_inf(), hv->positive_inf());
+
+			hv->for_each_nonzero([&](uint32_t index, uint32_t count)
+			{
+				w.value(hv->value_at_index(index), count);
+			});
+
+			w.end();
+		}
+	}
+
+}} // namespace { namespace aux {
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct pinba_view___base_t : public pinba_view_t
@@ -103,6 +280,40 @@ struct pinba_view___base_t : public pinba_view_t
 		return;
 	}
 
+	virtual int  index_init(pinba_handler_t*, uint idx, bool sorted) override
+	{
+		return 0;
+	}
+
+	virtual int  index_end(pinba_handler_t*) override
+	{
+		return 0;
+	}
+
+	virtual int  index_read_map(pinba_handler_t*, uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag) override
+	{
+		return HA_ERR_WRONG_COMMAND;
+	}
+
+	virtual int  index_next(pinba_handler_t*, uchar *buf) override
+	{
+		return HA_ERR_END_OF_FILE;
+	}
+
+	virtual const COND* cond_push(pinba_handler_t*, const COND *cond) override
+	{
+		return cond;
+	}
+
+	virtual void cond_pop(pinba_handler_t*) override
+	{
+	}
+
+	virtual int  reset(pinba_handler_t*) override
+	{
+		return 0;
+	}
+
 	virtual int  info(pinba_handler_t*, uint) const override
 	{
 		return 0;
@@ -479,6 +690,7 @@ private:
 				STORE_FIELD (26, timeval_to_double(rstats->last_tick_tv));
 				STORE_FIELD (27, duration_seconds_as_double(rstats->last_tick_prepare_d));
 				STORE_FIELD (28, duration_seconds_as_double(rstats->last_snapshot_merge_d));
+				STORE_FIELD (29, rstats->packets_dropped_by_rtag_bloom);
 			}
 		} // field for
 
@@ -496,6 +708,27 @@ struct pinba_view___report_snapshot_t : public pinba_view___base_t
 	report_snapshot_t::position_t  next_pos_;   // to read NEXT row, aka rnd_next()
 	report_snapshot_t::position_t  curr_pos_;   // last returned row pos, for position()
 
+	// all percentiles for one row are calculated at once, when the first percentile field is read
+	mutable void const             *percentiles_histogram_ = nullptr; // histogram that values are for
+	mutable std::vector<duration_t> percentiles_values_;
+
+	// simple predicates from WHERE, that we can check before filling the row (see cond_push())
+	struct pushed_cond_t
+	{
+		Item      *item;         // references exactly one field of this table, all other args are constants
+		Field     *field;
+		unsigned   field_index;  // key or data field
+
+		// key field predicates depend on key word only, so evaluate them once per word
+		std::unordered_map<uint32_t, bool> result_by_word_id;
+	};
+	std::vector<pushed_cond_t>  pushed_conds_;        // statement scoped, cleared in reset()
+	std::vector<size_t>         pushed_conds_marks_; // pushed_conds_ size before each cond_push(), for cond_pop()
+
+	// rows to return (largest first), when table shows only top rows, see pinba_view_conf_t::top_n
+	std::vector<report_snapshot_t::position_t>  top_positions_;
+	size_t                                      top_next_ = 0;
+
 	static constexpr unsigned const n_data_fields___by_request = 18;
 	static constexpr unsigned const n_data_fields___by_timer   = 15;
 	static constexpr unsigned const n_data_fields___by_packet  = 7;
@@ -503,7 +736,8 @@ struct pinba_view___report_snapshot_t : public pinba_view___base_t
 public:
 
 	// with 'order by' mysql calls us like this:
-	// XXX: rnd_init is basically called twice and we merge snapshot data twice (and DIFFERENT snapshot data!)
+	// NOTE: rnd_init is basically called twice, but snapshot is kept until external_lock(F_UNLCK), see below
+	//       and prepared snapshots are shared between selects within one report tick, see get_report_snapshot_prepared()
 	//
 	// 1. get the table data for filesort
 	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
@@ -567,6 +801,7 @@ public:
 
 		curr_pos_ = snapshot_->pos_first();
 		next_pos_ = curr_pos_;
+		top_next_ = 0;
 
 		return 0;
 	}
@@ -582,7 +817,16 @@ public:
 	{
 		// LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, next_pos: {2}", __func__, handler, ff::as_hex_string(str_ref{(char*)&next_pos_, sizeof(next_pos_)}));
 
-		if (snapshot_->pos_equal(next_pos_, snapshot_->pos_last()))
+		if (share_data_->view_conf->top_n > 0)
+			return this->rnd_next___top(handler);
+
+		auto const last_pos = snapshot_->pos_last();
+
+		// skip rows that can't match pushed down condition, before paying for percentiles, histograms, etc.
+		while (!snapshot_->pos_equal(next_pos_, last_pos) && !this->row_matches_pushed_conds(handler, next_pos_))
+			next_pos_ = snapshot_->pos_next(next_pos_);
+
+		if (snapshot_->pos_equal(next_pos_, last_pos))
 			return HA_ERR_END_OF_FILE;
 
 		MEOW_DEFER(
@@ -605,6 +849,143 @@ public:
 		return this->fill_row_at_position(handler, pos);
 	}
 
+	// index lookup is the same select as a scan (same snapshot), that just skips iteration
+	// position() works as usual, since curr_pos_ is set to found row
+	virtual int index_init(pinba_handler_t *handler, uint idx, bool sorted) override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, idx: {2}, snapshot: {3}", __func__, handler, idx, snapshot_.get());
+
+		if (!snapshot_)
+		{
+			int const r = this->init_for_new_select(handler);
+			if (r != 0)
+				return r;
+		}
+
+		curr_pos_ = snapshot_->pos_last();
+		next_pos_ = curr_pos_;
+
+		return 0;
+	}
+
+	virtual int index_end(pinba_handler_t *handler) override
+	{
+		// nothing to see here, see cleanup_select_data()
+		return 0;
+	}
+
+	virtual int index_read_map(pinba_handler_t *handler, uchar *buf, const uchar *key_buf, key_part_map keypart_map, enum ha_rkey_function find_flag) override
+	{
+		// hash lookup only, mysql should not ask for anything else, given our index_flags()
+		if (find_flag != HA_READ_KEY_EXACT)
+			return HA_ERR_WRONG_COMMAND;
+
+		auto *table       = handler->current_table();
+		auto *key_info    = &table->key_info[handler->active_index];
+		auto const *rinfo = snapshot_->report_info();
+
+		unsigned const n_key_fields = rinfo->n_key_parts;
+
+		if (key_info->user_defined_key_parts != n_key_fields)
+			return HA_ERR_WRONG_COMMAND;
+
+		// unpack key into record fields, to get values in a uniform way regardless of column types
+		auto *old_rmap = dbug_tmp_use_all_columns(table, table->read_set);
+		auto *old_wmap = dbug_tmp_use_all_columns(table, table->write_set);
+		MEOW_DEFER(
+			dbug_tmp_restore_column_map(table->read_set, old_rmap);
+			dbug_tmp_restore_column_map(table->write_set, old_wmap);
+		);
+
+		key_restore(table->record[0], key_buf, key_info, key_info->key_length);
+
+		// key parts might be in any order in mysql index, report key is in column order
+		uint32_t word_ids[PINBA_LIMIT___MAX_KEY_PARTS] = {};
+
+		for (unsigned i = 0; i < n_key_fields; i++)
+		{
+			Field *field = key_info->key_part[i].field;
+			unsigned const field_index = field->field_index;
+
+			if ((field_index >= n_key_fields) || field->is_null())
+				return HA_ERR_KEY_NOT_FOUND;
+
+			char   tmp_buf[256];
+			String tmp { tmp_buf, sizeof(tmp_buf), &my_charset_bin };
+
+			String const *value = field->val_str(&tmp);
+			str_ref const word  = { value->ptr(), size_t(value->length()) };
+
+			// word not in dictionary -> no row can have it
+			word_ids[field_index] = snapshot_->dictionary()->find_word_id(word);
+			if (word_ids[field_index] == 0)
+				return HA_ERR_KEY_NOT_FOUND;
+		}
+
+		report_key_t key;
+		for (unsigned i = 0; i < n_key_fields; i++)
+			key.push_back(word_ids[i]);
+
+		auto const pos = snapshot_->pos_find(key);
+		if (snapshot_->pos_equal(pos, snapshot_->pos_last()))
+			return HA_ERR_KEY_NOT_FOUND;
+
+		// must be consistent with a scan, that returns top rows only
+		if (share_data_->view_conf->top_n > 0)
+		{
+			bool const is_top = std::any_of(top_positions_.begin(), top_positions_.end(), [&](report_snapshot_t::position_t const& top_pos)
+			{
+				return snapshot_->pos_equal(top_pos, pos);
+			});
+
+			if (!is_top)
+				return HA_ERR_KEY_NOT_FOUND;
+		}
+
+		// keys are unique, index_next() has nothing more to return
+		curr_pos_ = pos;
+		next_pos_ = snapshot_->pos_last();
+
+		return this->fill_row_at_position(handler, curr_pos_);
+	}
+
+	virtual int index_next(pinba_handler_t *handler, uchar *buf) override
+	{
+		return HA_ERR_END_OF_FILE;
+	}
+
+	// mysql still checks the whole condition for rows we return, so we only need to be conservative here
+	// i.e. use predicates we understand to skip rows, ignore everything else
+	virtual const COND* cond_push(pinba_handler_t *handler, const COND *cond) override
+	{
+		pushed_conds_marks_.push_back(pushed_conds_.size());
+
+		this->collect_pushed_conds(handler, const_cast<COND*>(cond));
+
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, pushed predicates: {2}", __func__, handler, pushed_conds_.size() - pushed_conds_marks_.back());
+
+		return cond;
+	}
+
+	virtual void cond_pop(pinba_handler_t *handler) override
+	{
+		// might have been cleared already, see reset()
+		if (pushed_conds_marks_.empty())
+			return;
+
+		pushed_conds_.erase(pushed_conds_.begin() + pushed_conds_marks_.back(), pushed_conds_.end());
+		pushed_conds_marks_.pop_back();
+	}
+
+	// pushed conditions point to statement items and fields, that are gone after the statement ends
+	// can't wait for external_lock(F_UNLCK) here, it does not come after every statement under LOCK TABLES
+	virtual int reset(pinba_handler_t *handler) override
+	{
+		pushed_conds_.clear();
+		pushed_conds_marks_.clear();
+		return 0;
+	}
+
 	virtual void position(pinba_handler_t *handler, const uchar *record) const override
 	{
 		// FIXME: gcc 4.9 doesn't support std::is_trivially_copyable
@@ -652,10 +1033,6 @@ private:
 			*share_data_ = static_cast<pinba_share_data_t const&>(*share); // a copy
 		}
 
-		LOG_DEBUG(P_L_, "snapshot::{0}; getting snapshot for t: {1}, r: {2}", __func__, share_data_->mysql_name, share_data_->report_name);
-
-		snapshot_ = P_E_->get_report_snapshot(share_data_->report_name);
-
 		// check if percentile fields are being requested and do not merge histograms if not
 
 		bool const need_percentiles = [&]()
@@ -711,7 +1088,8 @@ private:
 			return false;
 		}();
 
-		// perform snapshot merge, this might take some time
+		// get merged snapshot, this might take some time
+		// or might be instant, if some other select has already merged current report data (see coordinator)
 		// TODO: write this time back to originating report's stats (non-trivial)
 		{
 			meow::stopwatch_t sw;
@@ -725,9 +1103,11 @@ private:
 			if (need_percentiles)
 				flags |= report_snapshot_t::merge_flags::with_histograms;
 
-			snapshot_->prepare(flags);
+			LOG_DEBUG(P_L_, "snapshot::{0}; getting snapshot for t: {1}, r: {2}", __func__, share_data_->mysql_name, share_data_->report_name);
+
+			snapshot_ = P_E_->get_report_snapshot_prepared(share_data_->report_name, flags);
 
-			LOG_DEBUG(P_L_, "snapshot::{0}; snapshot for: {1}, prepare (flags: {2}) took {3} seconds ({4} rows)",
+			LOG_DEBUG(P_L_, "snapshot::{0}; snapshot for: {1}, get + prepare (flags: {2}) took {3} seconds ({4} rows)",
 				__func__, share_data_->mysql_name,
 				ff::as_hex(flags),
 				sw.stamp(), snapshot_->row_count());
@@ -738,6 +1118,9 @@ private:
 			debug_dump_report_snapshot(stderr, snapshot_.get(), share_data_->mysql_name);
 		}
 
+		if (share_data_->view_conf->top_n > 0)
+			this->select_top_rows();
+
 		return 0;
 	}
 	catch (std::exception const& e)
@@ -751,6 +1134,390 @@ private:
 	{
 		share_data_.reset();
 		snapshot_.reset();
+
+		percentiles_histogram_ = nullptr;
+		percentiles_values_.clear();
+
+		top_positions_.clear();
+		top_next_ = 0;
+	}
+
+	// select top_n rows with largest top_data_field, before any key strings or percentiles are touched
+	// 'ORDER BY <field> DESC LIMIT N' on a full report makes mysql sort all rows (and fill them first)
+	// while here it's a bounded heap over row data only
+	void select_top_rows()
+	{
+		meow::stopwatch_t sw;
+
+		auto const *view_conf = share_data_->view_conf.get();
+
+		struct top_row_t
+		{
+			int64_t                        value;
+			report_snapshot_t::position_t  pos;
+		};
+
+		auto const greater = [](top_row_t const& l, top_row_t const& r) { return l.value > r.value; };
+
+		// min-heap, smallest of the top rows is at the front
+		std::vector<top_row_t> heap;
+		heap.reserve(std::min<size_t>(view_conf->top_n, snapshot_->row_count()));
+
+		auto const last_pos = snapshot_->pos_last();
+		for (auto pos = snapshot_->pos_first(); !snapshot_->pos_equal(pos, last_pos); pos = snapshot_->pos_next(pos))
+		{
+			int64_t const value = this->row_data_value(pos, view_conf->top_data_field);
+
+			if (heap.size() < view_conf->top_n)
+			{
+				heap.push_back({ .value = value, .pos = pos });
+				std::push_heap(heap.begin(), heap.end(), greater);
+				continue;
+			}
+
+			if (value <= heap.front().value)
+				continue;
+
+			std::pop_heap(heap.begin(), heap.end(), greater);
+			heap.back() = { .value = value, .pos = pos };
+			std::push_heap(heap.begin(), heap.end(), greater);
+		}
+
+		// largest first
+		std::sort_heap(heap.begin(), heap.end(), greater);
+
+		top_positions_.clear();
+		top_positions_.reserve(heap.size());
+		for (auto const& row : heap)
+			top_positions_.push_back(row.pos);
+
+		LOG_DEBUG(P_L_, "snapshot::{0}; selected {1} top rows out of {2}, took {3} seconds", __func__, top_positions_.size(), snapshot_->row_count(), sw.stamp());
+	}
+
+	int rnd_next___top(pinba_handler_t *handler)
+	{
+		while ((top_next_ < top_positions_.size()) && !this->row_matches_pushed_conds(handler, top_positions_[top_next_]))
+			top_next_++;
+
+		if (top_next_ >= top_positions_.size())
+			return HA_ERR_END_OF_FILE;
+
+		curr_pos_ = top_positions_[top_next_++];
+
+		return this->fill_row_at_position(handler, curr_pos_);
+	}
+
+	// data field value to sort rows by, field numbers are the same as in store_row_data_field()
+	// see parse_top_data_field() for fields that can be used
+	int64_t row_data_value(report_snapshot_t::position_t const& row_pos, unsigned findex) const
+	{
+		auto const *rinfo = snapshot_->report_info();
+
+		if (REPORT_KIND__BY_REQUEST_DATA == rinfo->kind)
+		{
+			auto const *row = reinterpret_cast<report_row_data___by_request_t const*>(snapshot_->get_data(row_pos));
+
+			switch (findex)
+			{
+				case 0:  return row->req_count;
+				case 3:  return row->time_total.nsec;
+				case 6:  return row->ru_utime.nsec;
+				case 9:  return row->ru_stime.nsec;
+				case 12: return row->traffic;
+				case 15: return row->mem_used;
+			}
+		}
+		else if (REPORT_KIND__BY_TIMER_DATA == rinfo->kind)
+		{
+			auto const *row = reinterpret_cast<report_row_data___by_timer_t const*>(snapshot_->get_data(row_pos));
+
+			switch (findex)
+			{
+				case 0:  return row->req_count;
+				case 3:  return row->hit_count;
+				case 6:  return row->time_total.nsec;
+				case 9:  return row->ru_utime.nsec;
+				case 12: return row->ru_stime.nsec;
+			}
+		}
+		else if (REPORT_KIND__BY_PACKET_DATA == rinfo->kind)
+		{
+			auto const *row = reinterpret_cast<report_row_data___by_packet_t const*>(snapshot_->get_data(row_pos));
+
+			switch (findex)
+			{
+				case 0: return row->req_count;
+				case 1: return row->timer_count;
+				case 2: return row->time_total.nsec;
+				case 3: return row->ru_utime.nsec;
+				case 4: return row->ru_stime.nsec;
+				case 5: return row->traffic;
+				case 6: return row->mem_used;
+			}
+		}
+
+		return 0;
+	}
+
+	// take AND-ed parts of condition, that look like <field> <op> <constants>
+	// ex. req_count > 100, script IN ('a', 'b'), host LIKE 'www%'
+	void collect_pushed_conds(pinba_handler_t *handler, Item *item)
+	{
+		if (item->type() == Item::COND_ITEM)
+		{
+			auto *cond = static_cast<Item_cond*>(item);
+
+			// parts of OR can't be checked one by one
+			if (cond->functype() != Item_func::COND_AND_FUNC)
+				return;
+
+			List_iterator<Item> li(*cond->argument_list());
+			while (Item *arg = li++)
+				this->collect_pushed_conds(handler, arg);
+
+			return;
+		}
+
+		if (item->type() != Item::FUNC_ITEM)
+			return;
+
+		auto *func = static_cast<Item_func*>(item);
+
+		switch (func->functype())
+		{
+			case Item_func::EQ_FUNC:
+			case Item_func::NE_FUNC:
+			case Item_func::LT_FUNC:
+			case Item_func::LE_FUNC:
+			case Item_func::GE_FUNC:
+			case Item_func::GT_FUNC:
+			case Item_func::BETWEEN:
+			case Item_func::IN_FUNC:
+			case Item_func::LIKE_FUNC:
+			break;
+
+			default:
+				return;
+		}
+
+		auto *table  = handler->current_table();
+		Field *field = nullptr;
+
+		for (uint i = 0; i < func->argument_count(); i++)
+		{
+			Item *arg = func->arguments()[i]->real_item();
+
+			if ((arg->type() == Item::FIELD_ITEM) && (static_cast<Item_field*>(arg)->field->table == table))
+			{
+				if (field != nullptr) // field compared to another field
+					return;
+
+				field = static_cast<Item_field*>(arg)->field;
+				continue;
+			}
+
+			if (!arg->basic_const_item())
+				return;
+		}
+
+		if (field == nullptr)
+			return;
+
+		// key and data fields only, percentiles and histograms are what we're trying not to calculate
+		auto const *view_conf = handler->current_share()->view_conf.get();
+		unsigned const n_fields = view_conf->keys.size() + n_data_fields_for_view(view_conf->kind);
+
+		if (field->field_index >= n_fields)
+			return;
+
+		pushed_conds_.push_back({ .item = item, .field = field, .field_index = field->field_index });
+	}
+
+	// checks pushed predicates against the row, writes only the fields they reference
+	bool row_matches_pushed_conds(pinba_handler_t *handler, report_snapshot_t::position_t const& row_pos)
+	{
+		if (pushed_conds_.empty())
+			return true;
+
+		auto *table = handler->current_table();
+		auto const key = snapshot_->get_key(row_pos);
+
+		unsigned const n_key_fields = snapshot_->report_info()->n_key_parts;
+
+		// same as in fill_row_at_position()
+		auto *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+		MEOW_DEFER(
+			dbug_tmp_restore_column_map(table->write_set, old_map);
+		);
+
+		for (auto& cond : pushed_conds_)
+		{
+			Field *field = cond.field;
+
+			if (cond.field_index < n_key_fields)
+			{
+				uint32_t const word_id = key[cond.field_index];
+
+				auto const it = cond.result_by_word_id.find(word_id);
+				if (it != cond.result_by_word_id.end())
+				{
+					if (!it->second)
+						return false;
+					continue;
+				}
+
+				str_ref const word = snapshot_->dictionary()->get_word(word_id);
+
+				field->set_notnull();
+				field->store(word.begin(), word.c_length(), &my_charset_bin);
+
+				bool const matched = (cond.item->val_int() != 0);
+				cond.result_by_word_id.emplace(word_id, matched);
+
+				if (!matched)
+					return false;
+			}
+			else
+			{
+				this->store_row_data_field(&field, cond.field_index - n_key_fields, row_pos);
+
+				if (cond.item->val_int() == 0)
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	static unsigned n_data_fields_for_view(pinba_view_kind_t kind)
+	{
+		switch (kind)
+		{
+			case pinba_view_kind::report_by_request_data: return n_data_fields___by_request;
+			case pinba_view_kind::report_by_timer_data:   return n_data_fields___by_timer;
+			case pinba_view_kind::report_by_packet_data:  return n_data_fields___by_packet;
+			default:                                      return 0;
+		}
+	}
+
+	// store row data field (findex is relative to first data field), returns false if findex is not a data field
+	bool store_row_data_field(Field **field, unsigned findex, report_snapshot_t::position_t const& row_pos) const
+	{
+		// NOTE: per_sec values divide by configured time_window, not the span history currently covers
+		//       history covers less after rollup eviction (see report_history_tiers_t) and before it fills up
+		auto const *rinfo = snapshot_->report_info();
+
+		if (REPORT_KIND__BY_REQUEST_DATA == rinfo->kind)
+		{
+			constexpr unsigned const n_data_fields = n_data_fields___by_request;
+			if (findex < n_data_fields)
+			{
+				auto const *row    = reinterpret_cast<report_row_data___by_request_t*>(snapshot_->get_data(row_pos));
+				auto const *totals = reinterpret_cast<report_row_data___by_request_t*>(snapshot_->get_data_totals());
+
+				switch (findex)
+				{
+					// req_count
+					STORE_FIELD    (0,  row->req_count);
+					STORE_FIELD    (1,  double(row->req_count) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_I(2,  row->req_count, totals->req_count);
+
+					// time_total
+					STORE_FIELD    (3,  duration_seconds_as_double(row->time_total));
+					STORE_FIELD    (4,  duration_seconds_as_double(row->time_total) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_D(5,  row->time_total, totals->time_total);
+
+					// ru_utime
+					STORE_FIELD    (6,  duration_seconds_as_double(row->ru_utime));
+					STORE_FIELD    (7,  duration_seconds_as_double(row->ru_utime) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_D(8,  row->ru_utime, totals->ru_utime);
+
+					// ru_stime
+					STORE_FIELD    (9,  duration_seconds_as_double(row->ru_stime));
+					STORE_FIELD    (10, duration_seconds_as_double(row->ru_stime) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_D(11, row->ru_stime, totals->ru_stime);
+
+					// traffic
+					STORE_FIELD    (12, row->traffic);
+					STORE_FIELD    (13, double(row->traffic) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_I(14, row->traffic, totals->traffic);
+
+					// mem_used
+					STORE_FIELD    (15, row->mem_used);
+					STORE_FIELD    (16, double(row->mem_used) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_I(17, row->mem_used, totals->mem_used);
+				}
+
+				return true;
+			}
+		}
+		else if (REPORT_KIND__BY_TIMER_DATA == rinfo->kind)
+		{
+			static unsigned const n_data_fields = n_data_fields___by_timer;
+			if (findex < n_data_fields)
+			{
+				auto const *row    = reinterpret_cast<report_row_data___by_timer_t*>(snapshot_->get_data(row_pos));
+				auto const *totals = reinterpret_cast<report_row_data___by_timer_t*>(snapshot_->get_data_totals());
+
+				switch (findex)
+				{
+					// req_count
+					STORE_FIELD    (0, row->req_count);
+					STORE_FIELD    (1, double(row->req_count) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_I(2, row->req_count, totals->req_count);
+
+					// hit_count
+					STORE_FIELD    (3, row->hit_count);
+					STORE_FIELD    (4, double(row->hit_count) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_I(5, row->hit_count, totals->hit_count);
+
+					// time_total
+					STORE_FIELD    (6, duration_seconds_as_double(row->time_total));
+					STORE_FIELD    (7, duration_seconds_as_double(row->time_total) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_D(8, row->time_total, totals->time_total);
+
+					// ru_utime
+					STORE_FIELD    (9, duration_seconds_as_double(row->ru_utime));
+					STORE_FIELD    (10, duration_seconds_as_double(row->ru_utime) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_D(11, row->ru_utime, totals->ru_utime);
+
+					// ru_stime
+					STORE_FIELD    (12, duration_seconds_as_double(row->ru_stime));
+					STORE_FIELD    (13, duration_seconds_as_double(row->ru_stime) / duration_seconds_as_double(rinfo->time_window));
+					STORE_PERCENT_D(14, row->ru_stime, totals->ru_stime);
+				}
+
+				return true;
+			}
+		}
+		else if (REPORT_KIND__BY_PACKET_DATA == rinfo->kind)
+		{
+			static unsigned const n_data_fields = n_data_fields___by_packet;
+			if (findex < n_data_fields)
+			{
+				auto const *row = reinterpret_cast<report_row_data___by_packet_t*>(snapshot_->get_data(row_pos));
+
+				switch (findex)
+				{
+					STORE_FIELD(0, row->req_count);
+					STORE_FIELD(1, row->timer_count);
+					STORE_FIELD(2, duration_seconds_as_double(row->time_total));
+					STORE_FIELD(3, duration_seconds_as_double(row->ru_utime));
+					STORE_FIELD(4, duration_seconds_as_double(row->ru_stime));
+					STORE_FIELD(5, row->traffic);
+					STORE_FIELD(6, row->mem_used);
+				}
+
+				return true;
+			}
+		}
+		else
+		{
+			LOG_ERROR(P_L_, "snapshot::{0}; unknown report snapshot data_kind: {1}", __func__, rinfo->kind);
+			// XXX: should we assert here or something?
+		}
+
+		return false;
 	}
 
 	int fill_row_at_position(pinba_handler_t *handler, report_snapshot_t::position_t const& row_pos) const
@@ -790,123 +1557,14 @@ private:
 			}
 
 			// row data comes next
-			if (REPORT_KIND__BY_REQUEST_DATA == rinfo->kind)
 			{
-				constexpr unsigned const n_data_fields = n_data_fields___by_request;
-				if (findex < n_data_fields)
-				{
-					auto const *row    = reinterpret_cast<report_row_data___by_request_t*>(snapshot_->get_data(row_pos));
-					auto const *totals = reinterpret_cast<report_row_data___by_request_t*>(snapshot_->get_data_totals());
-
-					switch (findex)
-					{
-						// req_count
-						STORE_FIELD    (0,  row->req_count);
-						STORE_FIELD    (1,  double(row->req_count) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(2,  row->req_count, totals->req_count);
-
-						// time_total
-						STORE_FIELD    (3,  duration_seconds_as_double(row->time_total));
-						STORE_FIELD    (4,  duration_seconds_as_double(row->time_total) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(5,  row->time_total, totals->time_total);
-
-						// ru_utime
-						STORE_FIELD    (6,  duration_seconds_as_double(row->ru_utime));
-						STORE_FIELD    (7,  duration_seconds_as_double(row->ru_utime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(8,  row->ru_utime, totals->ru_utime);
-
-						// ru_stime
-						STORE_FIELD    (9,  duration_seconds_as_double(row->ru_stime));
-						STORE_FIELD    (10, duration_seconds_as_double(row->ru_stime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(11, row->ru_stime, totals->ru_stime);
-
-						// traffic
-						STORE_FIELD    (12, row->traffic);
-						STORE_FIELD    (13, double(row->traffic) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(14, row->traffic, totals->traffic);
-
-						// mem_used
-						STORE_FIELD    (15, row->mem_used);
-						STORE_FIELD    (16, double(row->mem_used) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(17, row->mem_used, totals->mem_used);
-					}
-
+				if (this->store_row_data_field(field, findex, row_pos))
 					continue;
-				}
-				findex -= n_data_fields;
-			}
-			else if (REPORT_KIND__BY_TIMER_DATA == rinfo->kind)
-			{
-				static unsigned const n_data_fields = n_data_fields___by_timer;
-				if (findex < n_data_fields)
-				{
-					auto const *row    = reinterpret_cast<report_row_data___by_timer_t*>(snapshot_->get_data(row_pos));
-					auto const *totals = reinterpret_cast<report_row_data___by_timer_t*>(snapshot_->get_data_totals());
-
-					switch (findex)
-					{
-						// req_count
-						STORE_FIELD    (0, row->req_count);
-						STORE_FIELD    (1, double(row->req_count) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(2, row->req_count, totals->req_count);
-
-						// hit_count
-						STORE_FIELD    (3, row->hit_count);
-						STORE_FIELD    (4, double(row->hit_count) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(5, row->hit_count, totals->hit_count);
-
-						// time_total
-						STORE_FIELD    (6, duration_seconds_as_double(row->time_total));
-						STORE_FIELD    (7, duration_seconds_as_double(row->time_total) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(8, row->time_total, totals->time_total);
-
-						// ru_utime
-						STORE_FIELD    (9, duration_seconds_as_double(row->ru_utime));
-						STORE_FIELD    (10, duration_seconds_as_double(row->ru_utime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(11, row->ru_utime, totals->ru_utime);
-
-						// ru_stime
-						STORE_FIELD    (12, duration_seconds_as_double(row->ru_stime));
-						STORE_FIELD    (13, duration_seconds_as_double(row->ru_stime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(14, row->ru_stime, totals->ru_stime);
-					}
-
-					continue;
-				}
-				findex -= n_data_fields;
-			}
-			else if (REPORT_KIND__BY_PACKET_DATA == rinfo->kind)
-			{
-				static unsigned const n_data_fields = n_data_fields___by_packet;
-				if (findex < n_data_fields)
-				{
-					auto const *row = reinterpret_cast<report_row_data___by_packet_t*>(snapshot_->get_data(row_pos));
-
-					switch (findex)
-					{
-						STORE_FIELD(0, row->req_count);
-						STORE_FIELD(1, row->timer_count);
-						STORE_FIELD(2, duration_seconds_as_double(row->time_total));
-						STORE_FIELD(3, duration_seconds_as_double(row->ru_utime));
-						STORE_FIELD(4, duration_seconds_as_double(row->ru_stime));
-						STORE_FIELD(5, row->traffic);
-						STORE_FIELD(6, row->mem_used);
-					}
-
-					continue;
-				}
-				findex -= n_data_fields;
-			}
-			else
-			{
-				LOG_ERROR(P_L_, "snapshot::{0}; unknown report snapshot data_kind: {1}", __func__, rinfo->kind);
-				// XXX: should we assert here or something?
+				findex -= n_data_fields_for_view(share_data_->view_conf->kind);
 			}
 
 			// percentiles
-			// TODO: calculate all required percentiles in one go
-			//       performance testing shows that for short (~100 items) histograms it gives no effect whatsoever
-			//       need to to test for large ones (10k+ items)
+			// all of them are calculated in one pass over the histogram, and cached for the row
 			auto const& percentiles = share_data_->view_conf->percentiles;
 
 			unsigned const n_percentile_fields = percentiles.size();
@@ -921,29 +1579,41 @@ private:
 				// protect against percentile field in report without percentiles
 				if (histogram != nullptr)
 				{
-					auto const percentile_d = [&]() -> duration_t
+					if (percentiles_histogram_ != histogram)
 					{
+						percentiles_values_.resize(n_percentile_fields);
+
 						// if (HISTOGRAM_KIND__HASHTABLE == rinfo->hv_kind)
 						// {
 						// 	auto const *hv = static_cast<histogram_t const*>(histogram);
-						// 	return get_percentile(*hv, *hv_conf, percentiles[findex]);
+						// 	get_percentiles(*hv, *hv_conf, percentiles.data(), n_percentile_fields, percentiles_values_.data());
 						// }
 
 						if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
 						{
 							auto const *hv = static_cast<flat_histogram_t const*>(histogram);
-							return get_percentile(*hv, *hv_conf, percentiles[findex]);
+							get_percentiles(*hv, *hv_conf, percentiles.data(), n_percentile_fields, percentiles_values_.data());
 						}
-
-						if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+						else if (HISTOGRAM_KIND__SKETCH == rinfo->hv_kind)
+						{
+							auto const *hv = static_cast<flat_histogram_t const*>(histogram);
+							get_percentiles___sketch(*hv, *hv_conf, percentiles.data(), n_percentile_fields, percentiles_values_.data());
+						}
+						else if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
 						{
 							auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
-							return get_percentile(*hv, *hv_conf, percentiles[findex]);
+							get_percentiles(*hv, *hv_conf, percentiles.data(), n_percentile_fields, percentiles_values_.data());
+						}
+						else
+						{
+							assert(!"must not be reached");
+							std::fill(percentiles_values_.begin(), percentiles_values_.end(), duration_t{0});
 						}
 
-						assert(!"must not be reached");
-						return {0};
-					}();
+						percentiles_histogram_ = histogram;
+					}
+
+					duration_t const percentile_d = percentiles_values_[findex];
 
 					LOG_DEBUG(P_L_, "snapshot::{0}; percentile[{1}] = {2}", __func__, percentiles[findex], percentile_d);
 
@@ -966,12 +1636,6 @@ private:
 					{
 						std::string result;
 
-						uint32_t const hv_min_ms = (rinfo->hv_min_value / d_millisecond).nsec;
-						uint32_t const hv_max_ms = hv_min_ms + ((rinfo->hv_bucket_count * rinfo->hv_bucket_d) / d_millisecond).nsec;
-
-						ff::fmt(result, "hv={0}:{1}:{2};", hv_min_ms, hv_max_ms, rinfo->hv_bucket_count);
-						ff::fmt(result, "values=[");
-
 						// if (HISTOGRAM_KIND__HASHTABLE == rinfo->hv_kind)
 						// {
 						// 	auto const *hv = static_cast<histogram_t const*>(histogram);
@@ -989,53 +1653,22 @@ private:
 						// 		ff::fmt(result, "{0}max:{1}", hv_map.empty() ? "" : ", ", hv->positive_inf());
 						// }
 
-						if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
+						if (share_data_->view_conf->hv_binary_output)
 						{
-							auto const *hv = static_cast<flat_histogram_t const*>(histogram);
-
-							auto const& hvalues = hv->values;
-							for (auto it = hvalues.begin(), it_end = hvalues.end(); it != it_end; ++it)
-							{
-								ff::fmt(result, "{0}{1}:{2}", (hvalues.begin() == it)?"":", ", it->bucket_id, it->value);
-							}
-
-							if (hv->negative_inf > 0)
-								ff::fmt(result, "{0}min:{1}", hvalues.empty() ? "" : ", ", hv->negative_inf);
-
-							if (hv->positive_inf > 0)
-								ff::fmt(result, "{0}max:{1}", hvalues.empty() ? "" : ", ", hv->positive_inf);
+							aux::hv_binary_writer_t w = { .out = result };
+							aux::hv_write(w, rinfo, histogram);
 						}
-
-						if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+						else
 						{
-							auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
-
-							bool printed_something = false;
-
-							for (uint32_t i = 0; i < hv->counts_len(); i++)
-							{
-								if (hv->count_at_index(i) == 0)
-									continue;
-
-								ff::fmt(result, "{0}{1}: {2}", (printed_something)?", ":"", hv->value_at_index(i), hv->count_at_index(i));
-								printed_something = true;
-							}
-
-							if (hv->negative_inf() > 0)
-							{
-								ff::fmt(result, "{0}min:{1}", (printed_something)?", ":"", hv->negative_inf());
-								printed_something = true;
-							}
+							// hdr output has always been "<value>: <count>", keep it that way
+							str_ref const kv_separator = (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+														? meow::ref_lit(": ")
+														: meow::ref_lit(":");
 
-							if (hv->positive_inf() > 0)
-							{
-								ff::fmt(result, "{0}max:{1}", (printed_something)?", ":"", hv->positive_inf());
-								printed_something = true;
-							}
+							aux::hv_text_writer_t w = { .out = result, .kv_separator = kv_separator };
+							aux::hv_write(w, rinfo, histogram);
 						}
 
-						ff::fmt(result, "]");
-
 						return result;
 					}();
 
@@ -1140,13 +1773,49 @@ static pinba_share_ptr pinba_share_get_or_create_locked(char const *table_name)
 }
 
 
-static void share_init_with_table_comment_locked(pinba_share_ptr& share, str_ref table_comment)
+// indexes are hash lookups over full report key (see pinba_handler_t::index_flags())
+// so the only index allowed is the one on all key columns (in any order)
+static void table_keys_validate(TABLE const *table, pinba_view_conf_t const& conf)
+{
+	for (uint i = 0; i < table->s->keys; i++)
+	{
+		KEY const *key_info = &table->key_info[i];
+
+		if (conf.keys.empty())
+			throw std::runtime_error("indexes are supported only for reports with keys");
+
+		if (key_info->user_defined_key_parts != conf.keys.size())
+			throw std::runtime_error(ff::fmt_str("index must include all {0} report key columns", conf.keys.size()));
+
+		uint32_t seen_mask = 0;
+
+		for (uint j = 0; j < key_info->user_defined_key_parts; j++)
+		{
+			unsigned const field_index = key_info->key_part[j].fieldnr - 1;
+
+			if ((field_index >= conf.keys.size()) || (seen_mask & (1u << field_index)))
+				throw std::runtime_error(ff::fmt_str("index must include all {0} report key columns", conf.keys.size()));
+
+			// lookups compare key words byte by byte, case insensitive collations would find less rows than a scan
+			if (!(key_info->key_part[j].field->charset()->state & MY_CS_BINSORT))
+				throw std::runtime_error(ff::fmt_str("index column for key '{0}' must have binary collation (ex. VARBINARY or COLLATE latin1_bin)", conf.keys[field_index]));
+
+			seen_mask |= (1u << field_index);
+		}
+	}
+}
+
+static void share_init_with_table_comment_locked(pinba_share_ptr& share, TABLE const *table, str_ref table_comment)
 {
 	assert(!share->view_conf);
 	assert(!share->report);
 	assert(!share->report_active);
 
-	share->view_conf   = pinba_view_conf_parse(share->mysql_name, table_comment);
+	// validate before touching the share
+	auto view_conf = pinba_view_conf_parse(share->mysql_name, table_comment);
+	table_keys_validate(table, *view_conf);
+
+	share->view_conf   = std::move(view_conf);
 	share->report      = pinba_view_report_create(*share->view_conf);
 
 	if (share->report)
@@ -1202,7 +1871,7 @@ int pinba_handler_t::create(const char *table_name, TABLE *table_arg, HA_CREATE_
 		auto share = pinba_share_get_or_create_locked(table_name);
 
 		str_ref const comment = { table_arg->s->comment.str, size_t(table_arg->s->comment.length) };
-		share_init_with_table_comment_locked(share, comment);
+		share_init_with_table_comment_locked(share, table_arg, comment);
 	}
 	catch (std::exception const& e)
 	{
@@ -1255,7 +1924,7 @@ int pinba_handler_t::open(const char *table_name, int mode, uint test_if_locked)
 					throw std::runtime_error("pinba table must have a comment, please see docs");
 
 				str_ref const comment = { table->s->comment.str, size_t(table->s->comment.length) };
-				share_init_with_table_comment_locked(share, comment);
+				share_init_with_table_comment_locked(share, table, comment);
 			}
 		} // P_CTX_->lock released here
 
@@ -1309,6 +1978,36 @@ int pinba_handler_t::close(void)
 	DBUG_RETURN(0);
 }
 
+int pinba_handler_t::activate_report_if_needed()
+{
+	std::unique_lock<std::mutex> lk_(P_CTX_->lock);
+
+	try
+	{
+		// report not active - might need to activate
+		if (share_->report_needs_engine && !share_->report_active)
+		{
+			assert(share_->report);
+
+			pinba_error_t const err = P_E_->add_report(share_->report);
+			if (err)
+				throw std::runtime_error(ff::fmt_str("can't activate report: {0}", err.what()));
+
+			share_->report.reset(); // do not hold onto the report after activation
+			share_->report_active = true;
+		}
+	}
+	catch (std::exception const& e)
+	{
+		LOG_ERROR(P_L_, "{0}; table: {1}, error: {2}", __func__, share_->mysql_name, e.what());
+
+		my_printf_error(ER_CANT_CREATE_TABLE, "[pinba] THIS IS A BUG, report! %s", MYF(0), e.what());
+		return HA_ERR_INTERNAL_ERROR;
+	}
+
+	return 0;
+}
+
 /**
 	@brief
 	rnd_init() is called when the system wants the storage engine to do a table
@@ -1326,32 +2025,9 @@ int pinba_handler_t::rnd_init(bool scan)
 {
 	DBUG_ENTER(__PRETTY_FUNCTION__);
 
-	{
-		std::unique_lock<std::mutex> lk_(P_CTX_->lock);
-
-		try
-		{
-			// report not active - might need to activate
-			if (share_->report_needs_engine && !share_->report_active)
-			{
-				assert(share_->report);
-
-				pinba_error_t const err = P_E_->add_report(share_->report);
-				if (err)
-					throw std::runtime_error(ff::fmt_str("can't activate report: {0}", err.what()));
-
-				share_->report.reset(); // do not hold onto the report after activation
-				share_->report_active = true;
-			}
-		}
-		catch (std::exception const& e)
-		{
-			LOG_ERROR(P_L_, "{0}; table: {1}, error: {2}", __func__, share_->mysql_name, e.what());
-
-			my_printf_error(ER_CANT_CREATE_TABLE, "[pinba] THIS IS A BUG, report! %s", MYF(0), e.what());
-			DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
-		}
-	} // P_CTX_->lock released here
+	int const ar = this->activate_report_if_needed();
+	if (ar != 0)
+		DBUG_RETURN(ar);
 
 	// this should be nothrow
 	int const r = pinba_view_->rnd_init(this, scan);
@@ -1418,6 +2094,99 @@ int pinba_handler_t::rnd_pos(uchar *buf, uchar *pos)
 	DBUG_RETURN(r);
 }
 
+/**
+	@brief
+	Point lookups by the full report key, see pinba_handler_t::index_flags().
+	The key is resolved to word ids through the dictionary and searched in
+	snapshot hashtable directly, so 'WHERE key = ...' does not need a full scan.
+
+	@details
+	HA_ONLY_WHOLE_INDEX makes sure mysql only uses the index with all key parts set
+	and keys are unique, so index_next() always ends the lookup.
+*/
+int pinba_handler_t::index_init(uint idx, bool sorted)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const ar = this->activate_report_if_needed();
+	if (ar != 0)
+		DBUG_RETURN(ar);
+
+	int const r = pinba_view_->index_init(this, idx, sorted);
+
+	DBUG_RETURN(r);
+}
+
+int pinba_handler_t::index_end()
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const r = pinba_view_->index_end(this);
+
+	DBUG_RETURN(r);
+}
+
+int pinba_handler_t::index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const r = pinba_view_->index_read_map(this, buf, key, keypart_map, find_flag);
+
+	current_table()->status = (r != 0) ? STATUS_NOT_FOUND : 0;
+
+	DBUG_RETURN(r);
+}
+
+int pinba_handler_t::index_next(uchar *buf)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const r = pinba_view_->index_next(this, buf);
+
+	current_table()->status = (r != 0) ? STATUS_NOT_FOUND : 0;
+
+	DBUG_RETURN(r);
+}
+
+/**
+	@brief
+	Engine condition pushdown, views use simple predicates to skip rows early.
+	The whole condition is always returned back, so mysql checks it as usual.
+*/
+const COND *pinba_handler_t::cond_push(const COND *cond)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	const COND *r = pinba_view_->cond_push(this, cond);
+
+	DBUG_RETURN(r);
+}
+
+void pinba_handler_t::cond_pop()
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	pinba_view_->cond_pop(this);
+
+	DBUG_VOID_RETURN;
+}
+
+/**
+	@brief
+	Called at the end of every statement (even under LOCK TABLES), drops per-statement state.
+*/
+int pinba_handler_t::reset()
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	if (!pinba_view_) // not opened (or already closed)
+		DBUG_RETURN(0);
+
+	int const r = pinba_view_->reset(this);
+
+	DBUG_RETURN(r);
+}
+
 /**
 	@brief
 	position() is called after each call to rnd_next() if the data needs
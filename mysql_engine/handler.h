@@ -29,6 +29,20 @@ struct pinba_view_t : private boost::noncopyable
 	virtual int  rnd_next(pinba_handler_t*, uchar *buf) = 0;
 	virtual int  rnd_pos(pinba_handler_t*, uchar *buf, uchar *pos) const = 0;
 	virtual void position(pinba_handler_t*, const uchar *record) const = 0;
+
+	// point lookups by full report key (see pinba_handler_t::index_flags())
+	virtual int  index_init(pinba_handler_t*, uint idx, bool sorted) = 0;
+	virtual int  index_end(pinba_handler_t*) = 0;
+	virtual int  index_read_map(pinba_handler_t*, uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag) = 0;
+	virtual int  index_next(pinba_handler_t*, uchar *buf) = 0;
+
+	// engine condition pushdown, see pinba_handler_t::cond_push()
+	virtual const COND* cond_push(pinba_handler_t*, const COND *cond) = 0;
+	virtual void        cond_pop(pinba_handler_t*) = 0;
+
+	// end of statement, drop everything that points into statement items (see pinba_handler_t::reset())
+	virtual int  reset(pinba_handler_t*) = 0;
+
 	virtual int  info(pinba_handler_t*, uint) const = 0;
 	virtual int  extra(pinba_handler_t*, enum ha_extra_function operation) = 0;
 	virtual int  external_lock(pinba_handler_t*, int) = 0;
@@ -79,6 +93,8 @@ private:
 	pinba_share_ptr share_;      // current-table shared info
 	pinba_view_ptr  pinba_view_; // currently open pinba table wrapper
 
+	int activate_report_if_needed(); // before the first read from the table, see rnd_init() and index_init()
+
 public:
 	pinba_share_ptr current_share() const;
 	TABLE*          current_table() const;
@@ -97,7 +113,7 @@ public:
 		The name of the index type that will be used for display.
 		Don't implement this method unless you really have indexes.
 	*/
-	// const char *index_type(uint inx) { return "HASH"; }
+	const char *index_type(uint inx) { return "HASH"; }
 
 	/** @brief
 		The file extensions.
@@ -128,6 +144,9 @@ public:
 			| HA_NO_TRANSACTIONS
 			| HA_REC_NOT_IN_SEQ // must have
 			| HA_BINLOG_STMT_CAPABLE
+#ifdef HA_CAN_TABLE_CONDITION_PUSHDOWN
+			| HA_CAN_TABLE_CONDITION_PUSHDOWN // mariadb needs this to call cond_push()
+#endif
 			);
 	}
 
@@ -144,16 +163,13 @@ public:
 		If all_parts is set, MySQL wants to know the flags for the combined
 		index, up to and including 'part'.
 	*/
+	// the only index supported is a hash lookup by all report key columns (aka WHERE key1 = 'x' AND key2 = 'y')
+	// no ranges, no ordered scans, rows are found in snapshot hashtable directly
 	ulong index_flags(uint inx, uint part, bool all_parts) const
 	{
-		return 0;
+		return HA_ONLY_WHOLE_INDEX | HA_KEY_SCAN_NOT_ROR;
 	}
 
-	// ulong index_flags(uint inx, uint part, bool all_parts) const
-	// {
-	// 	return HA_READ_NEXT | HA_READ_PREV | HA_READ_ORDER | HA_ONLY_WHOLE_INDEX;;
-	// }
-
 	/** @brief
 		unireg.cc will call max_supported_record_length(), max_supported_keys(),
 		max_supported_key_parts(), uint max_supported_key_length()
@@ -172,7 +188,7 @@ public:
 		There is no need to implement ..._key_... methods if your engine doesn't
 		support indexes.
 	*/
-	  // uint max_supported_keys()          const { return 2; /* FIXME: add a constant for this */ }
+	uint max_supported_keys()          const { return 1; }
 
 	/** @brief
 		unireg.cc will call this to make sure that the storage engine can handle
@@ -183,7 +199,7 @@ public:
 		There is no need to implement ..._key_... methods if your engine doesn't
 		support indexes.
 	*/
-	// uint max_supported_key_parts()     const { return 1; }
+	uint max_supported_key_parts()     const { return PINBA_LIMIT___MAX_KEY_PARTS; }
 
 	/** @brief
 		unireg.cc will call this to make sure that the storage engine can handle
@@ -194,7 +210,8 @@ public:
 		There is no need to implement ..._key_... methods if your engine doesn't
 		support indexes.
 	*/
-	// uint max_supported_key_length()    const { return 256; }
+	uint max_supported_key_length()    const { return MAX_KEY_LENGTH; }
+	uint max_supported_key_part_length() const { return MAX_KEY_LENGTH; }
 
 	/** @brief
 		Called in test_quick_select to determine if indexes should be used.
@@ -217,8 +234,10 @@ public:
 	// int delete_row(const uchar *buf);
 
 	// index stuff
-	// int index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag);
-	// int index_next(uchar *buf);
+	int index_init(uint idx, bool sorted);
+	int index_end();
+	int index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag);
+	int index_next(uchar *buf);
 	// int index_prev(uchar *buf);
 	// int index_first(uchar *buf);
 	// int index_last(uchar *buf);
@@ -240,6 +259,10 @@ public:
 	int info(uint);                                               ///< required
 	int extra(enum ha_extra_function operation);
 	int external_lock(THD *thd, int lock_type);                   ///< required
+
+	const COND *cond_push(const COND *cond);
+	void cond_pop();
+	int reset();
 	// int delete_all_rows(void);
 	// int truncate();
 	// ha_rows records_in_range(uint inx, key_range *min_key, key_range *max_key);
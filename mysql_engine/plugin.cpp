@@ -282,6 +282,7 @@ static int pinba_engine_init(void *p)
 
 			.coordinator_input_buffer = pinba_variables()->coordinator_input_buffer,
 			.report_input_buffer      = pinba_variables()->report_input_buffer,
+			.report_merge_threads     = pinba_variables()->report_merge_threads,
 
 			.logger                   = logger,
 
@@ -485,6 +486,17 @@ static MYSQL_SYSVAR_UINT(report_input_buffer,
 	8 * 1024,
 	0);
 
+static MYSQL_SYSVAR_UINT(report_merge_threads,
+	pinba_variables()->report_merge_threads,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Number of threads each report uses to merge large ticks into history, 1 = merge in report thread",
+	NULL,
+	NULL,
+	1,
+	1,
+	16,
+	0);
+
 static MYSQL_SYSVAR_BOOL(packet_debug,
 	pinba_variables()->packet_debug,
 	PLUGIN_VAR_RQCMDARG,
@@ -545,6 +557,7 @@ static struct st_mysql_sys_var* system_variables[]= {
 	MYSQL_SYSVAR(repacker_batch_timeout_ms),
 	MYSQL_SYSVAR(coordinator_input_buffer),
 	MYSQL_SYSVAR(report_input_buffer),
+	MYSQL_SYSVAR(report_merge_threads),
 	MYSQL_SYSVAR(packet_debug),
 	MYSQL_SYSVAR(packet_debug_fraction),
 	NULL
@@ -1,11 +1,14 @@
 #include "mysql_engine/pinba_mysql.h"
 #include "mysql_engine/view_conf.h"
 
+#include <iterator>
+
 #include <meow/str_ref_algo.hpp>
 #include <meow/convert/number_from_string.hpp>
 
 #include "pinba/globals.h"
 #include "pinba/dictionary.h"
+#include "pinba/histogram.h"
 #include "pinba/report_by_request.h"
 #include "pinba/report_by_timer.h"
 #include "pinba/report_by_packet.h"
@@ -117,12 +120,12 @@ namespace { namespace aux {
 				auto const hv_range_s  = meow::sub_str_ref(pct_s, 3, pct_s.size());
 				auto const hv_values_v = meow::split_ex(hv_range_s, ":");
 
-				if (hv_values_v.size() != 3)
-					return ff::fmt_err("3 integer parts split by ':' expected");
+				if (hv_values_v.size() < 3 || hv_values_v.size() > 5)
+					return ff::fmt_err("3 to 5 integer parts split by ':' expected");
 
 				// LOG_DEBUG(P_L_, "hv_values_v = {{ {0}, {1}, {2} }", hv_values_v[0], hv_values_v[1], hv_values_v[2]);
 
-				// hv=<hv_lower_time_ms>:<hv_upper_time_ms>:<hv_bucket_count>
+				// hv=<hv_lower_time_ms>:<hv_upper_time_ms>:<hv_bucket_count>[:<precision_bits>[:<unit_us>]]
 				uint32_t hv_lower_ms;
 				if (!meow::number_from_string(&hv_lower_ms, hv_values_v[0]))
 					return ff::fmt_err("can't parse hv_lower_ms from '{0}'", pct_s);
@@ -143,12 +146,79 @@ namespace { namespace aux {
 				if (hv_bucket_count == 0)
 					return ff::fmt_err("histogram_spec: hv_bucket_count must be >= 0, in '{0}'", pct_s);
 
+				// aggregation precision, see histogram_conf_t
+				if (hv_values_v.size() > 3)
+				{
+					uint32_t precision_bits;
+					if (!meow::number_from_string(&precision_bits, hv_values_v[3]))
+						return ff::fmt_err("can't parse precision_bits from '{0}'", pct_s);
+
+					if (precision_bits < 1 || precision_bits > 14)
+						return ff::fmt_err("histogram_spec: precision_bits must be in range [1, 14], in '{0}'", pct_s);
+
+					vcf->hv_precision_bits = precision_bits;
+				}
+
+				if (hv_values_v.size() > 4)
+				{
+					uint32_t unit_us;
+					if (!meow::number_from_string(&unit_us, hv_values_v[4]))
+						return ff::fmt_err("can't parse unit_us from '{0}'", pct_s);
+
+					// hdr needs at least 2 units in range
+					if (unit_us == 0 || (uint64_t)unit_us * 2 > (uint64_t)hv_upper_ms * 1000)
+						return ff::fmt_err("histogram_spec: unit_us must be > 0 and <= hv_upper_ms/2, in '{0}'", pct_s);
+
+					vcf->hv_unit_size = unit_us * d_microsecond;
+				}
+
 				hv_present = true;
 
 				vcf->hv_bucket_count = hv_bucket_count;
 				vcf->hv_bucket_d     = (hv_upper_ms - hv_lower_ms) * d_millisecond / hv_bucket_count;
 				vcf->hv_min_value    = hv_lower_ms * d_millisecond;
 			}
+			else if (meow::prefix_compare(pct_s, "sketch=")) // 7 chars
+			{
+				auto const sketch_s        = meow::sub_str_ref(pct_s, 7, pct_s.size());
+				auto const sketch_values_v = meow::split_ex(sketch_s, ":");
+
+				if (sketch_values_v.size() != 1 && sketch_values_v.size() != 3)
+					return ff::fmt_err("sketch=<relative_error>[:<time_lower>:<time_upper>] expected, got '{0}'", pct_s);
+
+				// sketch=<relative_error>[:<hv_lower_time_ms>:<hv_upper_time_ms>]
+				double alpha;
+				if (!meow::number_from_string(&alpha, sketch_values_v[0]))
+					return ff::fmt_err("can't parse relative_error from '{0}'", pct_s);
+
+				if (!(alpha >= 0.0001 && alpha <= 0.5))
+					return ff::fmt_err("histogram_spec: sketch relative_error must be in range [0.0001, 0.5], in '{0}'", pct_s);
+
+				uint32_t hv_lower_ms = 0;
+				uint32_t hv_upper_ms = 3600 * 1000; // an hour, costs just ~1100 buckets with relative_error = 0.01
+
+				if (sketch_values_v.size() == 3)
+				{
+					if (!meow::number_from_string(&hv_lower_ms, sketch_values_v[1]))
+						return ff::fmt_err("can't parse hv_lower_ms from '{0}'", pct_s);
+
+					if (!meow::number_from_string(&hv_upper_ms, sketch_values_v[2]))
+						return ff::fmt_err("can't parse hv_upper_ms from '{0}'", pct_s);
+				}
+
+				if (hv_upper_ms <= hv_lower_ms)
+					return ff::fmt_err("histogram_spec: hv_upper_ms must be >= hv_lower_ms, in '{0}'", pct_s);
+
+				// bucket count is here for report_info_t and raw histogram output only, sketch buckets are not fixed width
+				uint32_t const hv_bucket_count = histogram___sketch_bucket_count(alpha, hv_upper_ms * d_millisecond, d_microsecond);
+
+				hv_present = true;
+
+				vcf->hv_sketch_alpha = alpha;
+				vcf->hv_bucket_count = hv_bucket_count;
+				vcf->hv_bucket_d     = (hv_upper_ms - hv_lower_ms) * d_millisecond / hv_bucket_count;
+				vcf->hv_min_value    = hv_lower_ms * d_millisecond;
+			}
 			else if (meow::prefix_compare(pct_s, "percentiles=")) // 12 chars
 			{
 				auto const pct_spec      = meow::sub_str_ref(pct_s, 12, pct_s.size());
@@ -181,7 +251,7 @@ namespace { namespace aux {
 
 		// TODO: should make histogram setup optional (i.e. have sensible defaults)
 		if (!hv_present)
-			return ff::fmt_err("hv=<time_lower>:<time_upper>:<n_buckets> must be present");
+			return ff::fmt_err("hv=<time_lower>:<time_upper>:<n_buckets> or sketch=<relative_error> must be present");
 
 		if (vcf->hv_bucket_count > PINBA_LIMIT___MAX_HISTOGRAM_SIZE)
 			return ff::fmt_err("we support maximum of {0} histogram buckets (this is a tunable compile-time constant)", PINBA_LIMIT___MAX_HISTOGRAM_SIZE);
@@ -237,6 +307,112 @@ namespace { namespace aux {
 		return {};
 	}
 
+	// data fields rows can be sorted by for top=, aka 'value' fields (not per_sec and percent ones)
+	// numbers are data field numbers, relative to the first data field in the table
+	static pinba_error_t parse_top_data_field(pinba_view_conf_t *vcf, str_ref field_name)
+	{
+		struct data_field_t
+		{
+			str_ref   name;
+			unsigned  number;
+		};
+
+		static data_field_t const by_request[] = {
+			{ meow::ref_lit("req_count"),  0  },
+			{ meow::ref_lit("time_total"), 3  },
+			{ meow::ref_lit("ru_utime"),   6  },
+			{ meow::ref_lit("ru_stime"),   9  },
+			{ meow::ref_lit("traffic"),    12 },
+			{ meow::ref_lit("mem_used"),   15 },
+		};
+
+		static data_field_t const by_timer[] = {
+			{ meow::ref_lit("req_count"),  0  },
+			{ meow::ref_lit("hit_count"),  3  },
+			{ meow::ref_lit("time_total"), 6  },
+			{ meow::ref_lit("ru_utime"),   9  },
+			{ meow::ref_lit("ru_stime"),   12 },
+		};
+
+		static data_field_t const by_packet[] = {
+			{ meow::ref_lit("req_count"),   0 },
+			{ meow::ref_lit("timer_count"), 1 },
+			{ meow::ref_lit("time_total"),  2 },
+			{ meow::ref_lit("ru_utime"),    3 },
+			{ meow::ref_lit("ru_stime"),    4 },
+			{ meow::ref_lit("traffic"),     5 },
+			{ meow::ref_lit("mem_used"),    6 },
+		};
+
+		auto const find_field = [&](data_field_t const *begin, data_field_t const *end) -> pinba_error_t
+		{
+			for (auto const *f = begin; f != end; ++f)
+			{
+				if (f->name == field_name)
+				{
+					vcf->top_data_field = f->number;
+					return {};
+				}
+			}
+
+			return ff::fmt_err("top: unknown data field '{0}' for this report type", field_name);
+		};
+
+		switch (vcf->kind)
+		{
+			case pinba_view_kind::report_by_request_data: return find_field(std::begin(by_request), std::end(by_request));
+			case pinba_view_kind::report_by_timer_data:   return find_field(std::begin(by_timer), std::end(by_timer));
+			case pinba_view_kind::report_by_packet_data:  return find_field(std::begin(by_packet), std::end(by_packet));
+			default:
+				return ff::fmt_err("top: not supported for this report type");
+		}
+	}
+
+	static pinba_error_t parse_report_options(pinba_view_conf_t *vcf, str_ref options_spec)
+	{
+		if (options_spec == "no_options")
+			return {};
+
+		auto const items = meow::split_ex(options_spec, ",");
+		for (auto const& item_s : items)
+		{
+			if (item_s == "background_snapshot")
+			{
+				vcf->background_snapshot = true;
+				continue;
+			}
+
+			if (item_s == "binary_histogram")
+			{
+				vcf->hv_binary_output = true;
+				continue;
+			}
+
+			if (meow::prefix_compare(item_s, "top=")) // 4 chars
+			{
+				// top=<row_count>:<data_field>
+				auto const top_s = meow::sub_str_ref(item_s, 4, item_s.size());
+				auto const top_v = meow::split_ex(top_s, ":");
+
+				if (top_v.size() != 2)
+					return ff::fmt_err("options_spec: top=<row_count>:<data_field> expected, got '{0}'", item_s);
+
+				if (!meow::number_from_string(&vcf->top_n, top_v[0]) || (vcf->top_n == 0))
+					return ff::fmt_err("options_spec: top row count must be a positive integer, got '{0}'", top_v[0]);
+
+				pinba_error_t const err = parse_top_data_field(vcf, top_v[1]);
+				if (err)
+					return err;
+
+				continue;
+			}
+
+			return ff::fmt_err("options_spec: unknown option '{0}'", item_s);
+		}
+
+		return {};
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 	auto pinba_view_conf_parse___internal(str_ref table_name, str_ref conf_string) -> std::shared_ptr<pinba_view_conf___internal_t>
@@ -268,8 +444,8 @@ namespace { namespace aux {
 		{
 			result->kind = pinba_view_kind::report_by_packet_data;
 
-			if (parts.size() != 6)
-				throw std::runtime_error("'packet/info' report options are: <aggregation_spec>/<key_spec>/<histogram_spec>/<filters>");
+			if (parts.size() != 6 && parts.size() != 7)
+				throw std::runtime_error("'packet/info' report options are: <aggregation_spec>/<key_spec>/<histogram_spec>/<filters>[/<options>]");
 
 			auto const aggregation_spec = parts[2];
 			auto const key_spec         = parts[3];
@@ -293,13 +469,20 @@ namespace { namespace aux {
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad filters_spec: {0}", err));
 
+			if (parts.size() > 6)
+			{
+				err = parse_report_options(result.get(), parts[6]);
+				if (err)
+					throw std::runtime_error(ff::fmt_str("bad options_spec: {0}", err));
+			}
+
 			return result;
 		}
 
 		if (report_type == "request")
 		{
-			if (parts.size() != 6)
-				throw std::runtime_error("'request' report options are: <aggregation_spec>/<key_spec>/<histogram_spec>/<filters>");
+			if (parts.size() != 6 && parts.size() != 7)
+				throw std::runtime_error("'request' report options are: <aggregation_spec>/<key_spec>/<histogram_spec>/<filters>[/<options>]");
 
 			auto const aggregation_spec = parts[2];
 			auto const key_spec         = parts[3];
@@ -326,13 +509,20 @@ namespace { namespace aux {
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad filters_spec: {0}", err));
 
+			if (parts.size() > 6)
+			{
+				err = parse_report_options(result.get(), parts[6]);
+				if (err)
+					throw std::runtime_error(ff::fmt_str("bad options_spec: {0}", err));
+			}
+
 			return result;
 		}
 
 		if (report_type == "timer")
 		{
-			if (parts.size() != 6)
-				throw std::runtime_error("'timer' report options are: <aggregation_spec>/<key_spec>/<histogram_spec>/<filters>");
+			if (parts.size() != 6 && parts.size() != 7)
+				throw std::runtime_error("'timer' report options are: <aggregation_spec>/<key_spec>/<histogram_spec>/<filters>[/<options>]");
 
 			auto const aggregation_spec = parts[2];
 			auto const key_spec         = parts[3];
@@ -359,6 +549,13 @@ namespace { namespace aux {
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad filters_spec: {0}", err));
 
+			if (parts.size() > 6)
+			{
+				err = parse_report_options(result.get(), parts[6]);
+				if (err)
+					throw std::runtime_error(ff::fmt_str("bad options_spec: {0}", err));
+			}
+
 			return result;
 		}
 
@@ -461,6 +658,13 @@ namespace { namespace aux {
 		conf->hv_bucket_count = vcf.hv_bucket_count;
 		conf->hv_bucket_d     = vcf.hv_bucket_d;
 		conf->hv_min_value    = vcf.hv_min_value;
+		conf->hv_unit_size    = vcf.hv_unit_size;
+		conf->hv_precision_bits = vcf.hv_precision_bits;
+
+		conf->background_snapshot = vcf.background_snapshot;
+
+		if (vcf.hv_sketch_alpha > 0)
+			return ff::fmt_err("sketch= histograms are supported in request and timer reports only");
 
 		if (vcf.min_time.nsec)
 			conf->filters.push_back(report_conf___by_packet_t::make_filter___by_min_time(vcf.min_time));
@@ -517,6 +721,11 @@ namespace { namespace aux {
 		conf->hv_bucket_count = vcf.hv_bucket_count;
 		conf->hv_bucket_d     = vcf.hv_bucket_d;
 		conf->hv_min_value    = vcf.hv_min_value;
+		conf->hv_unit_size    = vcf.hv_unit_size;
+		conf->hv_precision_bits = vcf.hv_precision_bits;
+		conf->hv_sketch_alpha = vcf.hv_sketch_alpha;
+
+		conf->background_snapshot = vcf.background_snapshot;
 
 		for (auto const& key_name : vcf.keys)
 		{
@@ -605,6 +814,11 @@ namespace { namespace aux {
 		conf->hv_bucket_count = vcf.hv_bucket_count;
 		conf->hv_bucket_d     = vcf.hv_bucket_d;
 		conf->hv_min_value    = vcf.hv_min_value;
+		conf->hv_unit_size    = vcf.hv_unit_size;
+		conf->hv_precision_bits = vcf.hv_precision_bits;
+		conf->hv_sketch_alpha = vcf.hv_sketch_alpha;
+
+		conf->background_snapshot = vcf.background_snapshot;
 
 		for (auto const& key_name : vcf.keys)
 		{
@@ -44,11 +44,20 @@ struct pinba_view_conf_t : private boost::noncopyable
 	uint32_t                    hv_bucket_count;
 	duration_t                  hv_bucket_d;
 	duration_t                  hv_min_value;
+	duration_t                  hv_unit_size;        // 0 if unset
+	int                         hv_precision_bits;   // 0 if unset
+	double                      hv_sketch_alpha;     // > 0 if sketch= is used instead of hv=
 	std::vector<double>         percentiles;
 
 	duration_t                  min_time;    // 0 if unset
 	duration_t                  max_time;    // 0 if unset
 
+	bool                        background_snapshot; // see report_info_t
+	bool                        hv_binary_output;    // raw histogram field is binary encoded, see README
+
+	uint32_t                    top_n;               // > 0 if table shows only top_n rows with largest top_data_field, see README
+	unsigned                    top_data_field;      // data field number, relative to the first data field
+
 	virtual ~pinba_view_conf_t() {}
 
 	virtual report_conf___by_packet_t const*   get___by_packet() const = 0;
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""
+Decode binary raw histogram field (report option 'binary_histogram') into text form,
+same as the one engine exports without the option.
+
+Takes hex encoded histograms (as in SELECT HEX(histogram)), one per line, on stdin or as arguments.
+
+Usage:
+> mysql -N -e 'SELECT HEX(histogram) FROM pinba.some_report' | python3 scripts/decode_histogram.py
+> python3 scripts/decode_histogram.py 0101...
+"""
+
+import sys
+
+HISTOGRAM_KIND__FLAT   = 1
+HISTOGRAM_KIND__HDR    = 2
+HISTOGRAM_KIND__SKETCH = 3
+
+
+def read_varint(data, pos):
+    result = 0
+    shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        result |= (b & 0x7f) << shift
+        if b < 0x80:
+            return result, pos
+        shift += 7
+
+
+def decode(data):
+    """returns dict with header fields and 'values': [(bucket_id, count), ...]"""
+    version, kind = data[0], data[1]
+    if version != 1:
+        raise ValueError("unsupported binary histogram version: {0}".format(version))
+
+    pos = 2
+    hv = {'kind': kind}
+    hv['min_ms'], pos = read_varint(data, pos)
+    hv['max_ms'], pos = read_varint(data, pos)
+    hv['bucket_count'], pos = read_varint(data, pos)
+
+    if kind == HISTOGRAM_KIND__SKETCH:
+        ppm, pos = read_varint(data, pos)
+        hv['relative_error'] = ppm / 1000000.0
+
+    hv['negative_inf'], pos = read_varint(data, pos)
+    hv['positive_inf'], pos = read_varint(data, pos)
+    n_values, pos = read_varint(data, pos)
+
+    values = []
+    bucket_id = 0
+    for _ in range(n_values):
+        delta, pos = read_varint(data, pos)
+        count, pos = read_varint(data, pos)
+        bucket_id += delta
+        values.append((bucket_id, count))
+    hv['values'] = values
+
+    return hv
+
+
+def format_text(hv):
+    if hv['kind'] == HISTOGRAM_KIND__SKETCH:
+        header = "sketch={0:g}:{1}:{2};".format(hv['relative_error'], hv['min_ms'], hv['max_ms'])
+    else:
+        header = "hv={0}:{1}:{2};".format(hv['min_ms'], hv['max_ms'], hv['bucket_count'])
+
+    kv_separator = ": " if hv['kind'] == HISTOGRAM_KIND__HDR else ":"
+
+    items = ["{0}{1}{2}".format(bucket_id, kv_separator, count) for bucket_id, count in hv['values']]
+    if hv['negative_inf'] > 0:
+        items.append("min:{0}".format(hv['negative_inf']))
+    if hv['positive_inf'] > 0:
+        items.append("max:{0}".format(hv['positive_inf']))
+
+    return header + "values=[" + ", ".join(items) + "]"
+
+
+def main(args):
+    lines = args if args else sys.stdin
+    for line in lines:
+        line = line.strip()
+        if not line or line == "NULL":
+            print(line)
+            continue
+        print(format_text(decode(bytes.fromhex(line))))
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -27,5 +27,6 @@ CREATE TABLE IF NOT EXISTS `pinba`.`active` (
   `ru_stime` double NOT NULL,
   `last_tick_time` double NOT NULL,
   `last_tick_prepare_duration` double NOT NULL,
-  `last_snapshot_merge_duration` double NOT NULL
+  `last_snapshot_merge_duration` double NOT NULL,
+  `packets_dropped_by_rtag_bloom` bigint(20) unsigned NOT NULL
 ) ENGINE=PINBA DEFAULT CHARSET=latin1 COMMENT='v2/active';
@@ -1,5 +1,8 @@
 #include "pinba_config.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -37,6 +40,23 @@ namespace { namespace aux {
 		size_t      nn_packets_buffer;  // NN_RCVBUF on nn_packets
 	};
 
+	// last prepared snapshot for the report, reused by selects until the next tick
+	// shared between report host (bumps generation) and coordinator (prepares and caches snapshots)
+	struct report_snapshot_cache_t
+	{
+		std::atomic<uint64_t>             tick_generation = {0}; // bumped by report host on every tick
+
+		// mtx is only held to check or publish, never across report host calls or prepare()
+		// concurrent selects wait on cv for the one that is preparing (single-flight)
+		std::mutex                        mtx;
+		std::condition_variable           cv;
+		bool                              preparing = false;
+		uint64_t                          snapshot_generation = 0;
+		report_snapshot_t::merge_flags_t  snapshot_flags = 0;
+		report_snapshot_ptr               snapshot;
+	};
+	using report_snapshot_cache_ptr = std::shared_ptr<report_snapshot_cache_t>;
+
 	struct report_host_t;
 	using  report_host_call_func_t = std::function<void(report_host_t*)>;
 
@@ -52,6 +72,8 @@ namespace { namespace aux {
 		virtual report_history_t*  report_history() const = 0;
 		virtual report_stats_t*    stats() = 0;
 
+		virtual report_snapshot_cache_ptr snapshot_cache() const = 0;
+
 		virtual bool process_batch(packet_batch_ptr) = 0;
 		virtual void execute_in_thread(report_host_call_func_t const&) = 0;
 	};
@@ -101,11 +123,14 @@ namespace { namespace aux {
 
 		repacker_state_ptr     repacker_state_;
 
+		report_snapshot_cache_ptr snapshot_cache_;
+
 	public:
 
 		report_host___new_thread_t(pinba_globals_t *globals, report_host_conf_t const& conf)
 			: globals_(globals)
 			, conf_(conf)
+			, snapshot_cache_(std::make_shared<report_snapshot_cache_t>())
 		{
 			packets_send_sock_
 				.open(AF_SP, NN_PUSH)
@@ -177,7 +202,20 @@ namespace { namespace aux {
 						report_tick_ptr tick = report_agg_->tick_now(now);
 						tick->repacker_state = std::move(repacker_state_);
 
-						report_history_->merge_tick(tick);
+						// cached snapshot is stale now, drop it (unless a select is checking or publishing right now)
+						// so that history doesn't have to copy data shared with it in merge_tick()
+						snapshot_cache_->tick_generation++;
+						{
+							std::unique_lock<std::mutex> lk_(snapshot_cache_->mtx, std::try_to_lock);
+							if (lk_.owns_lock())
+								snapshot_cache_->snapshot.reset();
+						}
+
+						// hand the tick over, so that history can recycle it, once converted
+						report_history_->merge_tick(std::move(tick));
+
+						if (report_->info()->background_snapshot)
+							this->publish_background_snapshot();
 
 						timeval_t const curr_tv    = os_unix::clock_monotonic_now();
 						timeval_t const curr_rt_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
@@ -223,6 +261,33 @@ namespace { namespace aux {
 			t_ = move(t);
 		}
 
+	private:
+
+		// prepare snapshot with everything merged and put it to cache, so that selects don't have to wait for merge
+		void publish_background_snapshot()
+		{
+			uint64_t const generation = snapshot_cache_->tick_generation.load();
+
+			report_snapshot_t::merge_flags_t const flags =
+				  report_snapshot_t::merge_flags::with_totals
+				| report_snapshot_t::merge_flags::with_histograms;
+
+			report_snapshot_ptr snapshot = report_history_->get_snapshot();
+			snapshot->prepare(flags);
+
+			// never block report host thread here, selects might be waiting for it while holding the lock
+			// skipping a publish is fine, selects will merge on their own for this tick
+			std::unique_lock<std::mutex> lk_(snapshot_cache_->mtx, std::try_to_lock);
+			if (!lk_.owns_lock())
+				return;
+
+			snapshot_cache_->snapshot_generation = generation;
+			snapshot_cache_->snapshot_flags      = flags;
+			snapshot_cache_->snapshot            = std::move(snapshot);
+		}
+
+	public:
+
 		virtual bool process_batch(packet_batch_ptr batch) override
 		{
 			stats_.batches_send_total += 1;
@@ -262,6 +327,11 @@ namespace { namespace aux {
 			return &stats_;
 		}
 
+		virtual report_snapshot_cache_ptr snapshot_cache() const override
+		{
+			return snapshot_cache_;
+		}
+
 		virtual void execute_in_thread(report_host_call_func_t const& func) override
 		{
 			// lock, so that multiple clients do not step on each other's toes
@@ -609,6 +679,79 @@ namespace { namespace aux {
 			return snapshot;
 		}
 
+		virtual report_snapshot_ptr get_report_snapshot_prepared(std::string const& report_name, report_snapshot_t::merge_flags_t flags) override
+		{
+			report_snapshot_cache_ptr cache = [&]()
+			{
+				std::unique_lock<std::mutex> lk_(mtx_);
+
+				auto const it = report_hosts_.find(report_name);
+				if (it == report_hosts_.end())
+					throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
+
+				return it->second->snapshot_cache();
+			}();
+
+			// do not hold mtx_ while preparing, other reports should not wait for us
+			std::unique_lock<std::mutex> cache_lk_(cache->mtx);
+
+			uint64_t generation;
+			while (true)
+			{
+				generation = cache->tick_generation.load();
+
+				// cached snapshot has all the data we need
+				if (cache->snapshot && (cache->snapshot_generation == generation) && ((cache->snapshot_flags & flags) == flags))
+				{
+					LOG_DEBUG(globals_->logger(), "{0}; {1}, reusing snapshot, generation: {2}", __func__, report_name, generation);
+					return cache->snapshot;
+				}
+
+				if (!cache->preparing)
+					break;
+
+				// someone else is merging, wait for the result and re-check
+				cache->cv.wait(cache_lk_);
+			}
+
+			// same data, but less merged, keep what was requested previously as well
+			if (cache->snapshot && (cache->snapshot_generation == generation))
+				flags |= cache->snapshot_flags;
+
+			cache->preparing = true;
+			cache_lk_.unlock();
+
+			report_snapshot_ptr snapshot;
+			try
+			{
+				// get_report_snapshot() takes mtx_ and waits for report host thread, must not hold cache->mtx here
+				snapshot = this->get_report_snapshot(report_name);
+				snapshot->prepare(flags);
+			}
+			catch (...)
+			{
+				cache_lk_.lock();
+				cache->preparing = false;
+				cache->cv.notify_all();
+				throw;
+			}
+
+			cache_lk_.lock();
+			cache->preparing = false;
+
+			// background publish might have cached a newer tick meanwhile, do not overwrite it
+			if (generation >= cache->snapshot_generation)
+			{
+				cache->snapshot_generation = generation;
+				cache->snapshot_flags      = flags;
+				cache->snapshot            = snapshot;
+			}
+
+			cache->cv.notify_all();
+
+			return snapshot;
+		}
+
 		virtual report_state_ptr get_report_state(std::string const& report_name) override
 		{
 			std::unique_lock<std::mutex> lk_(mtx_);
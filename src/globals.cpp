@@ -190,6 +190,11 @@ namespace { namespace aux {
 			return coordinator_->get_report_snapshot(name.str());
 		}
 
+		virtual report_snapshot_ptr get_report_snapshot_prepared(str_ref name, report_snapshot_t::merge_flags_t flags) override
+		{
+			return coordinator_->get_report_snapshot_prepared(name.str(), flags);
+		}
+
 	private:
 		// std::unique_ptr<pinba_globals_t>  globals_;
 		pinba_globals_t                   *globals_;
@@ -36,6 +36,7 @@ int main(int argc, char const *argv[])
 
 		.coordinator_input_buffer = 128,
 		.report_input_buffer      = 32,
+		.report_merge_threads     = 4,
 
 		.logger                   = {},
 	};
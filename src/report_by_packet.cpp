@@ -73,6 +73,13 @@ namespace { namespace aux {
 			, conf_(conf)
 			, hv_conf_(histogram___configure_with_rinfo(rinfo))
 		{
+			// request tags that filters need
+			for (auto const& filter : conf_.filters)
+			{
+				if (filter.rtag_name_id != 0)
+					rtag_bloom_.add(filter.rtag_name_id);
+			}
+
 			this->tick_now({});
 		}
 
@@ -83,6 +90,13 @@ namespace { namespace aux {
 
 		virtual void add(packet_t *packet) override
 		{
+			// packet must have all request tags we need
+			if (!packet->rtag_bloom.contains(this->rtag_bloom_))
+			{
+				stats_->packets_dropped_by_rtag_bloom++;
+				return;
+			}
+
 			// run all filters and check if packet is 'interesting to us'
 			for (size_t i = 0, i_end = conf_.filters.size(); i < i_end; ++i)
 			{
@@ -105,10 +119,24 @@ namespace { namespace aux {
 			stats_->packets_aggregated++;
 		}
 
+		// there is just a single row here, so no key lookups to stage (unlike other reports)
+		// but packets are scattered in batch nmpa, so prefetch a few packets ahead
 		virtual void add_multi(packet_t **packets, uint32_t packet_count) override
 		{
+			constexpr uint32_t prefetch_distance = 4;
+
 			for (uint32_t i = 0; i < packet_count; ++i)
+			{
+				// packet_t spans 2 cache lines, and blooms are in the second one
+				if (i + prefetch_distance < packet_count)
+				{
+					char const *next_packet = (char const*)packets[i + prefetch_distance];
+					__builtin_prefetch(next_packet);
+					__builtin_prefetch(next_packet + sizeof(packet_t) - 1);
+				}
+
 				this->add(packets[i]);
+			}
 		}
 
 		virtual report_tick_ptr tick_now(timeval_t curr_tv) override
@@ -136,6 +164,8 @@ namespace { namespace aux {
 		report_conf___by_packet_t  conf_;
 		histogram_conf_t           hv_conf_;
 
+		requesttag_bloom_t         rtag_bloom_;
+
 		tick_ptr                   tick_;
 	};
 
@@ -177,12 +207,13 @@ namespace { namespace aux {
 			struct snapshot_traits
 			{
 				using totals_t    = report_row_data___by_packet_t;
-				using src_ticks_t = ringbuffer_t;
+				using src_ticks_t = ring_t::view_t;
 				using hashtable_t = std::array<report_row___by_packet_t, 1>; // array to get iterators 'for free'
 
 				static report_key_t key_at_position(hashtable_t const&, hashtable_t::iterator const& it)    { return {}; }
 				static void*        value_at_position(hashtable_t const&, hashtable_t::iterator const& it)  { return (void*)it; }
 				static void*        hv_at_position(hashtable_t const&, hashtable_t::iterator const& it)     { return it->hv.get(); }
+				static hashtable_t::iterator find_key(hashtable_t& ht, report_key_t const& k)               { return (k.size() == 0) ? ht.begin() : ht.end(); }
 
 				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
 				{
@@ -259,7 +290,7 @@ namespace { namespace aux {
 				.nmpa           = nmpa_autofree_t(64 * 1024),
 			};
 
-			return meow::make_unique<snapshot_t>(sctx, ring_.get_ringbuffer());
+			return meow::make_unique<snapshot_t>(sctx, ring_.get_view());
 		}
 
 	private:
@@ -290,6 +321,10 @@ namespace { namespace aux {
 				.hv_bucket_count = conf_.hv_bucket_count,
 				.hv_bucket_d     = conf_.hv_bucket_d,
 				.hv_min_value    = conf_.hv_min_value,
+				.hv_unit_size    = conf_.hv_unit_size,
+				.hv_precision_bits = conf_.hv_precision_bits,
+
+				.background_snapshot = conf_.background_snapshot,
 			};
 		}
 
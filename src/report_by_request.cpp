@@ -1,13 +1,14 @@
+#include <algorithm>
+#include <vector>
+
 #include <boost/noncopyable.hpp>
 #include <boost/preprocessor/arithmetic/add.hpp>
 #include <boost/preprocessor/repetition/repeat.hpp>
 
 #include <meow/defer.hpp>
-#include <meow/utility/offsetof.hpp> // MEOW_SELF_FROM_MEMBER
 
 #include "pinba/globals.h"
 #include "pinba/histogram.h"
-#include "pinba/multi_merge.h"
 #include "pinba/packet.h"
 #include "pinba/repacker.h"
 #include "pinba/report.h"
@@ -66,6 +67,15 @@ namespace { namespace aux {
 				nmpa_free(&hv_nmpa);
 			}
 
+			// drop all data, but keep pool chunks, see tick_pool_t
+			void reset()
+			{
+				repacker_state.reset();
+				items.clear();
+				hvs.clear();
+				nmpa_reset(&hv_nmpa);
+			}
+
 		private: // not movable or copyable
 			tick_t(tick_t const&)            = delete;
 			tick_t(tick_t&&)                 = delete;
@@ -73,6 +83,9 @@ namespace { namespace aux {
 			tick_t& operator=(tick_t&&)      = delete;
 		};
 
+		using tick_pool_t   = report_tick_pool_t<tick_t>;
+		using tick_pool_ptr = std::shared_ptr<tick_pool_t>;
+
 	public: // aggregator
 
 		struct aggregator_t : public report_agg_t
@@ -89,10 +102,8 @@ namespace { namespace aux {
 			{
 			};
 
-			uint32_t raw_item_offset_get(key_t const& k)
+			uint32_t raw_item_offset_get(key_t const& k, uint64_t key_hash)
 			{
-				uint64_t const key_hash = report_key_impl___hasher_t()(k);
-
 				auto inserted_pair = tick_ht_.emplace_hash(key_hash, k, UINT_MAX);
 				uint32_t& off = inserted_pair.first.value();
 
@@ -118,10 +129,8 @@ namespace { namespace aux {
 				return new_off;
 			}
 
-			void raw_item_increment(key_t const& k, packet_t const *packet)
+			void raw_item_increment(uint32_t offset, packet_t const *packet)
 			{
-				uint32_t const offset = this->raw_item_offset_get(k);
-
 				tick_item_t& item = tick_->items[offset];
 
 				item.data.req_count  += 1;
@@ -140,13 +149,26 @@ namespace { namespace aux {
 
 		public:
 
-			aggregator_t(pinba_globals_t *globals, report_conf___by_request_t const& conf, report_info_t const& rinfo)
+			aggregator_t(pinba_globals_t *globals, report_conf___by_request_t const& conf, report_info_t const& rinfo, tick_pool_ptr tick_pool)
 				: globals_(globals)
 				, stats_(nullptr)
 				, conf_(conf)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
-				, tick_(meow::make_intrusive<tick_t>())
+				, tick_pool_(std::move(tick_pool))
+				, tick_(tick_pool_->get())
 			{
+				// request tags that keys and filters need
+				for (auto const& kd : conf_.keys)
+				{
+					if (kd.rtag_name_id != 0)
+						rtag_bloom_.add(kd.rtag_name_id);
+				}
+
+				for (auto const& filter : conf_.filters)
+				{
+					if (filter.rtag_name_id != 0)
+						rtag_bloom_.add(filter.rtag_name_id);
+				}
 			}
 
 			virtual void stats_init(report_stats_t *stats) override
@@ -156,11 +178,14 @@ namespace { namespace aux {
 
 			virtual report_tick_ptr tick_now(timeval_t curr_tv) override
 			{
+				size_t const prev_row_count = tick_ht_.size();
+
 				report_tick_ptr result = std::move(tick_);
-				tick_ = meow::make_intrusive<tick_t>();
+				tick_ = tick_pool_->get();
 
+				// keep buckets (unless there are way too many), to avoid rehashing all the way up from empty during the tick
 				tick_ht_.clear();
-				tick_ht_.rehash(0); // shrinks the hashtable
+				report_hashtable___presize(tick_ht_, prev_row_count);
 
 				return result;
 			}
@@ -188,8 +213,16 @@ namespace { namespace aux {
 				return result;
 			}
 
-			virtual void add(packet_t *packet) override
+			// run all packet checks and construct the key, returns false if packet is not interesting
+			bool collect_packet_key(packet_t *packet, key_t *out_key)
 			{
+				// packet must have all request tags we need, before doing anything expensive
+				if (!packet->rtag_bloom.contains(this->rtag_bloom_))
+				{
+					stats_->packets_dropped_by_rtag_bloom++;
+					return false;
+				}
+
 				// run all filters and check if packet is 'interesting to us'
 				for (size_t i = 0, i_end = conf_.filters.size(); i < i_end; ++i)
 				{
@@ -197,12 +230,12 @@ namespace { namespace aux {
 					if (!filter.func(packet))
 					{
 						stats_->packets_dropped_by_filters++;
-						return;
+						return false;
 					}
 				}
 
 				// construct a key, by runinng all key fetchers
-				key_t k;
+				key_t& k = *out_key;
 
 				for (size_t i = 0, i_end = conf_.keys.size(); i < i_end; ++i)
 				{
@@ -212,22 +245,69 @@ namespace { namespace aux {
 					if (!r.found)
 					{
 						stats_->packets_dropped_by_rtag++;
-						return;
+						return false;
 					}
 
 					k[i] = r.key_value;
 				}
 
-				// finally - find and update item
-				this->raw_item_increment(k, packet);
-
 				stats_->packets_aggregated++;
+				return true;
 			}
 
+			virtual void add(packet_t *packet) override
+			{
+				key_t k;
+
+				if (!this->collect_packet_key(packet, &k))
+					return;
+
+				// find and update item
+				uint32_t const offset = this->raw_item_offset_get(k, report_key_impl___hasher_t()(k));
+				this->raw_item_increment(offset, packet);
+			}
+
+			// batch version of add(), staged to hide memory latency on reports with lots of rows
+			//  1. run checks and extract keys + hashes for a chunk of packets
+			//  2. prefetch hashtable buckets for all keys
+			//  3. find/create items, prefetching each one (and it's histogram)
+			//  4. apply increments
 			virtual void add_multi(packet_t **packets, uint32_t packet_count) override
 			{
-				for (uint32_t i = 0; i < packet_count; ++i)
-					this->add(packets[i]);
+				for (uint32_t chunk_begin = 0; chunk_begin < packet_count; chunk_begin += packets_per_chunk)
+				{
+					uint32_t const chunk_end = std::min(packet_count, chunk_begin + packets_per_chunk);
+
+					batch_.clear();
+
+					for (uint32_t i = chunk_begin; i < chunk_end; ++i)
+					{
+						batch_item_t bi;
+
+						if (!this->collect_packet_key(packets[i], &bi.key))
+							continue;
+
+						bi.key_hash = report_key_impl___hasher_t()(bi.key);
+						bi.packet   = packets[i];
+						bi.offset   = 0;
+						batch_.push_back(bi);
+					}
+
+					for (auto const& bi : batch_)
+						tick_ht_.prefetch_hash(bi.key_hash);
+
+					for (auto& bi : batch_)
+					{
+						bi.offset = this->raw_item_offset_get(bi.key, bi.key_hash);
+
+						__builtin_prefetch(&tick_->items[bi.offset], 1);
+						if (conf_.hv_bucket_count > 0)
+							__builtin_prefetch(&tick_->hvs[bi.offset], 1);
+					}
+
+					for (auto const& bi : batch_)
+						this->raw_item_increment(bi.offset, bi.packet);
+				}
 			}
 
 		private:
@@ -236,15 +316,30 @@ namespace { namespace aux {
 			report_conf___by_request_t   conf_;
 			histogram_conf_t             hv_conf_;
 
+			requesttag_bloom_t           rtag_bloom_;
+
+			tick_pool_ptr                tick_pool_;
 			boost::intrusive_ptr<tick_t> tick_;
 			hashtable_t                  tick_ht_;
+
+			// add_multi() staging area, reused between batches
+			struct batch_item_t
+			{
+				key_t             key;
+				uint64_t          key_hash;
+				packet_t const    *packet;
+				uint32_t          offset;
+			};
+
+			static constexpr uint32_t packets_per_chunk = 32;
+			std::vector<batch_item_t>    batch_;
 		};
 
 	public: // history
 
 		struct history_t : public report_history_t
 		{
-			using ring_t       = report_history_ringbuffer_t;
+			using ring_t       = report_history_tiers_t;
 			using ringbuffer_t = ring_t::ringbuffer_t;
 
 			struct history_tick_t : public report_tick_t // inheric to get compatibility with history ring for free
@@ -252,18 +347,64 @@ namespace { namespace aux {
 				// precalculated mem usage, to avoid expensive computation in get_estimates()
 				uint64_t                       mem_used = 0;
 
-				std::deque<tick_item_t>        items; // should be the same as aggregator tick items, to move data
-				std::vector<flat_histogram_t>  hvs;   // keep this as vector, as we can preallocate (and need to copy anyway)
+				std::deque<tick_item_t>          items;    // should be the same as aggregator tick items, to move data
+				std::vector<packed_histogram_t>  hvs;      // keep this as vector, as we can preallocate
+				packed_histogram_arena_t         hv_arena; // hvs data
+				std::vector<uint32_t>            n_ticks;  // rollup ticks only: original ticks folded into each item
+
+				uint32_t item_n_ticks(size_t i) const
+				{
+					return (n_ticks.empty()) ? 1 : n_ticks[i];
+				}
 			};
 
+			// all ticks in the ring, merged (see report_history_window_t)
+			struct window_traits_t
+			{
+				using key_t  = typename report___by_request_t::key_t;
+				using data_t = typename report___by_request_t::data_t;
+				using tick_t = history_tick_t;
+
+				static size_t                    row_count(tick_t const& tick)              { return tick.items.size(); }
+				static uint64_t                  row_key_hash(tick_t const& tick, size_t i) { return tick.items[i].key_hash; }
+				static key_t const&              row_key(tick_t const& tick, size_t i)      { return tick.items[i].key; }
+				static data_t const&             row_data(tick_t const& tick, size_t i)     { return tick.items[i].data; }
+				static packed_histogram_t const& row_hv(tick_t const& tick, size_t i)       { return tick.hvs[i]; }
+				static uint32_t                  row_n_ticks(tick_t const& tick, size_t i)  { return tick.item_n_ticks(i); }
+
+				static void data_add(data_t *to, data_t const& from)
+				{
+					to->req_count  += from.req_count;
+					to->time_total += from.time_total;
+					to->ru_utime   += from.ru_utime;
+					to->ru_stime   += from.ru_stime;
+					to->traffic    += from.traffic;
+					to->mem_used   += from.mem_used;
+				}
+
+				static void data_subtract(data_t *to, data_t const& from)
+				{
+					to->req_count  -= from.req_count;
+					to->time_total -= from.time_total;
+					to->ru_utime   -= from.ru_utime;
+					to->ru_stime   -= from.ru_stime;
+					to->traffic    -= from.traffic;
+					to->mem_used   -= from.mem_used;
+				}
+			};
+
+			using window_t = report_history_window_t<window_traits_t>;
+
 		public:
 
-			history_t(pinba_globals_t *globals, report_info_t const& rinfo)
+			history_t(pinba_globals_t *globals, report_info_t const& rinfo, tick_pool_ptr tick_pool)
 				: globals_(globals)
 				, stats_(nullptr)
 				, rinfo_(rinfo)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
+				, tick_pool_(std::move(tick_pool))
 				, ring_(rinfo.tick_count)
+				, window_(rinfo.hv_enabled)
 			{
 			}
 
@@ -285,7 +426,7 @@ namespace { namespace aux {
 				h_tick->items = std::move(agg_tick->items);
 				h_tick->mem_used += h_tick->items.size() * sizeof(*h_tick->items.begin());
 
-				// migrate histograms, converting them from hashtable to flat
+				// migrate histograms, converting them from hashtable to packed flat
 				if (rinfo_.hv_enabled)
 				{
 					h_tick->hvs.reserve(agg_tick->hvs.size()); // we know the size in advance, mon
@@ -293,51 +434,43 @@ namespace { namespace aux {
 
 					for (auto const& src_hv : agg_tick->hvs)
 					{
-						h_tick->hvs.emplace_back(std::move(histogram___convert_hdr_to_flat(src_hv, hv_conf_)));
-
-						h_tick->mem_used += h_tick->hvs.back().values.capacity() * sizeof(*h_tick->hvs.back().values.begin());
+						h_tick->hvs.emplace_back((HISTOGRAM_KIND__SKETCH == rinfo_.hv_kind)
+							? histogram___pack_hdr_as_sketch(&h_tick->hv_arena, src_hv, hv_conf_)
+							: histogram___pack_hdr(&h_tick->hv_arena, src_hv, hv_conf_));
 					}
 
+					h_tick->hv_arena.shrink_to_fit();
+					h_tick->mem_used += h_tick->hv_arena.capacity();
+
 					// sanity
 					assert(h_tick->items.size() == agg_tick->hvs.size());
 				}
 
-				ring_.append(std::move(h_tick));
-			}
+				// converted, give it back to aggregator for reuse
+				tick_pool_->put(std::move(tick_base));
 
-			virtual report_estimates_t get_estimates() override
-			{
-				report_estimates_t result = {};
+				auto const new_tick_ref = h_tick; // keep alive until merged into window, ring might fold it away
+				history_tick_t const& new_tick = *new_tick_ref;
 
-				result.row_count = [&]() -> uint32_t
+				report_tick_ptr evicted = ring_.append(std::move(h_tick), [this](report_tick_ptr const *ticks, uint32_t n_ticks)
 				{
-					auto const& ringbuf = ring_.get_ringbuffer();
-					if (ringbuf.empty())
-						return 0;
-
-					uint32_t non_unique_rows = 0;
+					return this->rollup_ticks(ticks, n_ticks);
+				});
+				auto const *evicted_tick = static_cast<history_tick_t const*>(evicted.get());
 
-					for (auto const& tick_base : ringbuf)
-					{
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-						non_unique_rows += tick.items.size();
-					}
+				// evicted tick is still alive, we're holding a ref
+				window_.merge_tick(new_tick, evicted_tick, globals_->options()->report_merge_threads);
+			}
 
-					// got stats from snapshot merge with exact values, adjust based uniq to total rows ratio
-					if (stats_->last_snapshot_src_rows && stats_->last_snapshot_uniq_rows)
-					{
-						double const uniq_to_raw_fraction = (double)stats_->last_snapshot_uniq_rows / stats_->last_snapshot_src_rows;
-						return non_unique_rows * uniq_to_raw_fraction;
-					}
+			virtual report_estimates_t get_estimates() override
+			{
+				report_estimates_t result = {};
 
-					// no stats from snapshot merge yet,
-					// use average tick size (aka lean low and assume, all values repeat every tick)
-					return (uint32_t)std::ceil((double)non_unique_rows / ringbuf.size());
-				}();
+				result.row_count = window_.row_count();
 
 				result.mem_used += sizeof(*this);
 
-				for (auto const& tick_base : ring_.get_ringbuffer())
+				for (auto const& tick_base : ring_.get_view())
 				{
 					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
 
@@ -346,132 +479,99 @@ namespace { namespace aux {
 					result.mem_used += tick.mem_used;
 				}
 
+				// window
+				result.mem_used += window_.mem_used();
+
 				return result;
 			}
 
-		public: // snapshot
+		private: // history tiers
 
-			struct snapshot_traits
+			// merge several history ticks into one, for older parts of long histories (see report_history_tiers_t)
+			// window is not touched, as rollup is just a sum of ticks already there
+			// rollup items remember how many original ticks they cover, so that window takes them all out at once on eviction
+			report_tick_ptr rollup_ticks(report_tick_ptr const *ticks, uint32_t n_ticks)
 			{
-				using src_ticks_t = ringbuffer_t;
-				using totals_t    = report_row_data___by_request_t;
+				auto r_tick = meow::make_intrusive<history_tick_t>();
 
-				struct row_t
-				{
-					data_t       data;
-
-					// list of saved hvs, we merge only when requested (i.e. in hv_at_position)
-					// please note that we're also saving pointers to flat_histogram_t::values
-					// and will restore full structs on merge
-					// this a 'limitation' of multi_merge() function
-					std::vector<histogram_values_t const*>  saved_hv;
-					flat_histogram_t                        merged_hv;
-				};
-
-				struct hashtable_t
-					: public tsl::robin_map<
+				using index_t = tsl::robin_map<
 									  key_t
-									, row_t
+									, uint32_t
 									, report_key_impl___hasher_t
 									, report_key_impl___equal_t
-									, std::allocator<std::pair<key_t, row_t>>
-									, /*StoreHash=*/ true>
-				{
-				};
+									, std::allocator<std::pair<key_t, uint32_t>>
+									, /*StoreHash=*/ true>;
+				index_t index;
 
-			public:
+				// histograms are collected per row, merged all at once and packed into rollup tick arena at the end
+				packed_histogram_rollup_t hv_rollup;
 
-				static report_key_t key_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
+				for (uint32_t i = 0; i < n_ticks; i++)
 				{
-					return report_key_t { it->first };
-				}
+					auto const& src_tick = static_cast<history_tick_t const&>(*ticks[i]);
 
-				static void* value_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
-				{
-					return (void*)&it->second.data;
-				}
+					repacker_state___merge_to_from(r_tick->repacker_state, src_tick.repacker_state);
 
-				static void* hv_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
-				{
-					row_t *row = const_cast<row_t*>(&it->second);
-
-					if (row->saved_hv.empty()) // already merged
-						return &row->merged_hv;
-
-					struct merger_t
+					for (size_t j = 0; j < src_tick.items.size(); j++)
 					{
-						flat_histogram_t *to;
+						tick_item_t const& src = src_tick.items[j];
 
-						inline bool compare(histogram_value_t const& l, histogram_value_t const& r) const
-						{
-							return l.bucket_id < r.bucket_id;
-						}
+						auto const inserted_pair = index.emplace_hash(src.key_hash, src.key, (uint32_t)r_tick->items.size());
+						uint32_t const dst_offset = inserted_pair.first->second;
 
-						inline bool equal(histogram_value_t const& l, histogram_value_t const& r) const
-						{
-							return l.bucket_id == r.bucket_id;
-						}
+						if (rinfo_.hv_enabled)
+							hv_rollup.add(dst_offset, src_tick.hv_arena, src_tick.hvs[j]);
 
-						inline void reserve(size_t const sz)
+						if (inserted_pair.second)
 						{
-							to->values.reserve(sz);
-						}
+							r_tick->items.emplace_back();
 
-						inline void push_back(histogram_values_t const *seq, histogram_value_t const& v)
-						{
-							flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, seq);
-
-							bool const should_insert = [&]()
-							{
-								if (to->values.empty())
-									return true;
-
-								return !equal(to->values.back(), v);
-							}();
-
-							if (should_insert)
-							{
-								to->values.emplace_back(v);
-							}
-							else
-							{
-								to->values.back().value += v.value;
-							}
+							tick_item_t& dst = r_tick->items.back();
+							dst.key_hash = src.key_hash;
+							dst.key      = src.key;
+							dst.data     = src.data;
+
+							r_tick->n_ticks.push_back(src_tick.item_n_ticks(j));
+							continue;
 						}
-					};
 
-					// merge histogram values
-					merger_t merger = { .to = &row->merged_hv };
-					pinba::multi_merge(&merger, row->saved_hv.begin(), row->saved_hv.end());
+						tick_item_t& dst = r_tick->items[dst_offset];
 
-					// merge histogram totals
-					for (auto const *src_hv_values : row->saved_hv)
-					{
-						flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, src_hv_values);
-						row->merged_hv.total_count  += src->total_count;
-						row->merged_hv.negative_inf += src->negative_inf;
-						row->merged_hv.positive_inf += src->positive_inf;
+						r_tick->n_ticks[dst_offset] += src_tick.item_n_ticks(j);
+						window_traits_t::data_add(&dst.data, src.data);
 					}
-
-					// clear source
-					row->saved_hv.clear();
-
-					return &row->merged_hv;
 				}
 
-				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
+				if (rinfo_.hv_enabled)
 				{
-					for (auto const& tick_base : ticks)
+					r_tick->hvs.reserve(r_tick->items.size());
+					hv_rollup.merge((uint32_t)r_tick->items.size(), [&](uint32_t, flat_histogram_t const& hv)
 					{
-						if (!tick_base)
-							continue;
+						r_tick->hvs.emplace_back(histogram___pack_flat(&r_tick->hv_arena, hv));
+					});
 
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-
-						stats->row_count += tick.items.size();
-					}
+					r_tick->hv_arena.shrink_to_fit();
 				}
 
+				r_tick->n_ticks.shrink_to_fit();
+
+				r_tick->mem_used += r_tick->items.size() * sizeof(*r_tick->items.begin());
+				r_tick->mem_used += r_tick->n_ticks.capacity() * sizeof(*r_tick->n_ticks.begin());
+				r_tick->mem_used += r_tick->hvs.capacity() * sizeof(*r_tick->hvs.begin());
+				r_tick->mem_used += r_tick->hv_arena.capacity();
+
+				return r_tick;
+			}
+
+		public: // snapshot
+
+			struct snapshot_traits : public report_history_window___snapshot_traits_t<window_t>
+			{
+				using src_ticks_t = ring_t::view_t;
+				using totals_t    = report_row_data___by_request_t;
+
+				using hashtable_t = typename report_history_window___snapshot_traits_t<window_t>::hashtable_t;
+
 				static void calculate_totals(report_snapshot_ctx_t *snapshot_ctx, hashtable_t const& data, totals_t *totals)
 				{
 					for (auto const& data_pair : data)
@@ -486,82 +586,6 @@ namespace { namespace aux {
 						totals->mem_used   += row.mem_used;
 					}
 				}
-
-				// merge from src ringbuffer to snapshot data
-				static void merge_ticks_into_data(
-					  report_snapshot_ctx_t *snapshot_ctx
-					, src_ticks_t& ticks
-					, hashtable_t& to
-					, report_snapshot_t::merge_flags_t flags)
-				{
-					bool const need_histograms = (snapshot_ctx->rinfo.hv_enabled && (flags & report_snapshot_t::merge_flags::with_histograms));
-
-					// if we have result count estimate - try reserve the space in resulting hashtable
-					// this might get ugly, if we under-guess just slightly
-					// and face a giant rehash at the end of the merge
-					// but should save us some significant time on initial few rehashes
-					if (snapshot_ctx->estimates.row_count > 0)
-					{
-						to.reserve(snapshot_ctx->estimates.row_count);
-					}
-
-					uint64_t n_ticks = 0;
-					uint64_t key_lookups = 0;
-					uint64_t hv_appends = 0;
-
-					for (auto const& tick_base : ticks)
-					{
-						if (!tick_base)
-							continue;
-
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-
-						n_ticks++;
-
-						for (size_t i = 0; i < tick.items.size(); i++)
-						{
-							tick_item_t const& src = tick.items[i];
-
-							auto inserted_pair = to.emplace_hash(src.key_hash, src.key, row_t{});
-							row_t&         dst = inserted_pair.first.value();
-
-							dst.data.req_count  += src.data.req_count;
-							dst.data.time_total += src.data.time_total;
-							dst.data.ru_utime   += src.data.ru_utime;
-							dst.data.ru_stime   += src.data.ru_stime;
-							dst.data.traffic    += src.data.traffic;
-							dst.data.mem_used   += src.data.mem_used;
-
-							if (need_histograms)
-							{
-								flat_histogram_t const& src_hv = tick.hvs[i];
-
-								// try preallocate
-								if (dst.saved_hv.empty())
-									dst.saved_hv.reserve(ticks.size());
-
-								dst.saved_hv.push_back(&src_hv.values);
-							}
-						}
-
-						key_lookups += tick.items.size();
-
-						if (need_histograms)
-							hv_appends  += tick.hvs.size();
-					}
-
-					LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, key_lookups: {2}, hv_appends: {3}",
-						snapshot_ctx->rinfo.name, n_ticks, key_lookups, hv_appends);
-
-					// can clean ticks only if histograms were not merged
-					// since histogram merger uses raw pointers to tick_data_t::hvs[]::values
-					// and those need to be alive while this snapshot is alive
-					if (!need_histograms)
-					{
-						ticks.clear();
-						ticks.shrink_to_fit();
-					}
-				}
 			};
 
 			virtual report_snapshot_ptr get_snapshot() override
@@ -575,7 +599,7 @@ namespace { namespace aux {
 				};
 
 				using snapshot_t = report_snapshot__impl_t<snapshot_traits>;
-				return meow::make_unique<snapshot_t>(sctx, ring_.get_ringbuffer());
+				return meow::make_unique<snapshot_t>(sctx, ring_.get_view(), window_.get_view());
 			}
 
 		private:
@@ -583,8 +607,11 @@ namespace { namespace aux {
 			report_stats_t               *stats_;
 			report_info_t                rinfo_;
 			histogram_conf_t             hv_conf_;
+			tick_pool_ptr                tick_pool_;
 
-			report_history_ringbuffer_t  ring_;
+			report_history_tiers_t       ring_;
+
+			window_t                     window_;
 		};
 
 	public: // report_t
@@ -593,6 +620,7 @@ namespace { namespace aux {
 			: globals_(globals)
 			, stats_(nullptr)
 			, conf_(conf)
+			, tick_pool_(std::make_shared<tick_pool_t>())
 		{
 			rinfo_ = report_info_t {
 				.name            = conf_.name,
@@ -601,10 +629,15 @@ namespace { namespace aux {
 				.tick_count      = conf_.tick_count,
 				.n_key_parts     = (uint32_t)conf_.keys.size(),
 				.hv_enabled      = (conf_.hv_bucket_count > 0),
-				.hv_kind         = HISTOGRAM_KIND__FLAT,
+				.hv_kind         = (conf_.hv_sketch_alpha > 0) ? HISTOGRAM_KIND__SKETCH : HISTOGRAM_KIND__FLAT,
 				.hv_bucket_count = conf_.hv_bucket_count,
 				.hv_bucket_d     = conf_.hv_bucket_d,
 				.hv_min_value    = conf_.hv_min_value,
+				.hv_unit_size    = conf_.hv_unit_size,
+				.hv_precision_bits = conf_.hv_precision_bits,
+				.hv_sketch_alpha = conf_.hv_sketch_alpha,
+
+				.background_snapshot = conf_.background_snapshot,
 			};
 		}
 
@@ -620,12 +653,12 @@ namespace { namespace aux {
 
 		virtual report_agg_ptr create_aggregator() override
 		{
-			return std::make_shared<aggregator_t>(globals_, conf_, rinfo_);
+			return std::make_shared<aggregator_t>(globals_, conf_, rinfo_, tick_pool_);
 		}
 
 		virtual report_history_ptr create_history() override
 		{
-			return std::make_shared<history_t>(globals_, rinfo_);
+			return std::make_shared<history_t>(globals_, rinfo_, tick_pool_);
 		}
 
 	private:
@@ -634,6 +667,7 @@ namespace { namespace aux {
 		report_info_t                rinfo_;
 
 		report_conf___by_request_t   conf_;
+		tick_pool_ptr                tick_pool_; // shared between aggregators and history
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,13 +1,13 @@
 // #include <wchar.h> // wmemcmp
 
+#include <algorithm>
 #include <functional>
 #include <utility>
+#include <vector>
 
 #include <boost/preprocessor/arithmetic/add.hpp>
 #include <boost/preprocessor/repetition/repeat.hpp>
 
-#include <meow/utility/offsetof.hpp> // MEOW_SELF_FROM_MEMBER
-
 #include <tsl/robin_map.h>
 
 #include "misc/nmpa.h"
@@ -15,25 +15,53 @@
 #include "pinba/globals.h"
 #include "pinba/bloom.h"
 #include "pinba/histogram.h"
-#include "pinba/multi_merge.h"
 #include "pinba/packet.h"
 #include "pinba/report.h"
 #include "pinba/report_util.h"
 #include "pinba/report_by_timer.h"
+#include "pinba/simd_find.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-	template<size_t NKeys>
+	// key layouts (i.e. mix of key kinds) that aggregation code is specialized for at compile time
+	// layout is selected in create_report_by_timer(), based on report config
+	enum : int
+	{
+		KEY_LAYOUT__GENERIC         = 0,  // any mix of request tags, request fields and timer tags
+		KEY_LAYOUT__TIMER_TAGS      = 1,  // timer tags only, no per-packet key work at all
+		KEY_LAYOUT__FIELDS_AND_TAGS = 2,  // request fields + timer tags, no request tag lookups
+	};
+
+	inline int key_layout_from_config(report_conf___by_timer_t const& conf)
+	{
+		uint32_t n_request_tags = 0, n_request_fields = 0;
+
+		for (auto const& kd : conf.keys)
+		{
+			n_request_tags   += (RKD_REQUEST_TAG == kd.kind);
+			n_request_fields += (RKD_REQUEST_FIELD == kd.kind);
+		}
+
+		if (n_request_tags > 0)
+			return KEY_LAYOUT__GENERIC;
+
+		return (n_request_fields > 0)
+				? KEY_LAYOUT__FIELDS_AND_TAGS
+				: KEY_LAYOUT__TIMER_TAGS;
+	}
+
+	template<size_t NKeys, int KeyLayout>
 	struct report___by_timer_t : public report_t
 	{
 		typedef report_key_impl_t<NKeys>      key_t;
 		typedef report_row_data___by_timer_t  data_t;
 
-	public: // key extraction and transformation
+		static constexpr bool has_request_tags   = (KeyLayout == KEY_LAYOUT__GENERIC);
+		static constexpr bool has_request_fields = (KeyLayout != KEY_LAYOUT__TIMER_TAGS);
 
-		typedef meow::string_ref<report_key_t::value_type> key_subrange_t;
+	public: // key extraction and transformation
 
 		struct key_info_t
 		{
@@ -46,7 +74,7 @@ namespace { namespace aux {
 			{
 				key_descriptor_t  d;
 				uint32_t          remap_from;  // offset in split_key_d
-				uint32_t          remap_to;    // offset in conf.key_d
+				uint32_t          remap_to;    // offset in conf.key_d (aka final key), key parts are fetched straight there
 			};
 
 			typedef chunk_t<descriptor_t>          rkd_chunk_t;
@@ -92,48 +120,12 @@ namespace { namespace aux {
 				return rkd_range_t { split_key_d.begin() + size_before, split_key_d.size() - size_before };
 			}
 
-			key_subrange_t rtag_key_subrange(key_t& k) const
+			// number of timer tags in key, known at compile time for timer-tags-only layout
+			uint32_t timer_tag_count() const
 			{
-				return { k.begin() + (request_tag_r.begin() - split_key_d.begin()), request_tag_r.size() };
-			}
-
-			key_subrange_t rfield_key_subrange(key_t& k) const
-			{
-				return { k.begin() + (request_field_r.begin() - split_key_d.begin()), request_field_r.size() };
-			}
-
-			key_subrange_t timertag_key_subrange(key_t& k) const
-			{
-				return { k.begin() + (timer_tag_r.begin() - split_key_d.begin()), timer_tag_r.size() };
-			}
-
-			key_t remap_key(key_t const& flat_key) const
-			{
-				key_t result = {}; // avoid might-be-unitialized warning
-				assert(split_key_d.size() == result.size());
-
-				for (auto const& d : split_key_d)
-				{
-					result[d.remap_to] = flat_key[d.remap_from];
-				}
-
-				return result;
-			}
-
-			void remap_key_to_from(key_t& result, key_t const& flat_key) const
-			{
-				assert(split_key_d.size() == result.size());
-
-				// for (uint32_t i = 0; i < result.size(); i++)
-				// {
-				//     descriptor_t const& descriptor = split_key_d[i];
-				//     result[d.remap_to] = flat_key[i];
-				// }
-
-				for (auto const& d : split_key_d)
-				{
-					result[d.remap_to] = flat_key[d.remap_from];
-				}
+				return (KeyLayout == KEY_LAYOUT__TIMER_TAGS)
+						? NKeys
+						: timer_tag_r.size();
 			}
 		};
 
@@ -207,6 +199,15 @@ namespace { namespace aux {
 				nmpa_free(&item_nmpa);
 			}
 
+			// drop all data, but keep hashtable buckets and pool chunks, see tick_pool_t
+			void reset()
+			{
+				repacker_state.reset();
+				ht.clear();
+				nmpa_reset(&item_nmpa);
+				nmpa_reset(&hv_nmpa);
+			}
+
 		private: // not movable or copyable
 			tick_t(tick_t const&)            = delete;
 			tick_t(tick_t&&)                 = delete;
@@ -214,14 +215,15 @@ namespace { namespace aux {
 			tick_t& operator=(tick_t&&)      = delete;
 		};
 
+		using tick_pool_t   = report_tick_pool_t<tick_t>;
+		using tick_pool_ptr = std::shared_ptr<tick_pool_t>;
+
 	public: // aggregation
 
 		struct aggregator_t : public report_agg_t
 		{
-			tick_item_t& raw_item_reference(key_t const& k)
+			tick_item_t& raw_item_reference(key_t const& k, uint64_t key_hash)
 			{
-				uint64_t const key_hash = report_key_impl___hasher_t()(k);
-
 				auto inserted_pair = tick_->ht.emplace_hash(key_hash, k, nullptr);
 				tick_item_t *& item_ptr = inserted_pair.first.value();
 
@@ -241,19 +243,17 @@ namespace { namespace aux {
 				return *item_ptr;
 			}
 
-			void raw_item_increment(key_t const& k, packet_t const *packet, packed_timer_t const *timer)
+			void raw_item_increment(tick_item_t& item, packed_timer_t const *timer, uint64_t packet_unique)
 			{
-				tick_item_t& item = this->raw_item_reference(k);
-
 				item.data.hit_count  += timer->hit_count;
 				item.data.time_total += timer->value;
 				item.data.ru_utime   += timer->ru_utime;
 				item.data.ru_stime   += timer->ru_stime;
 
-				if (item.last_unique != packet_unqiue_)
+				if (item.last_unique != packet_unique)
 				{
 					item.data.req_count += 1;
-					item.last_unique    = packet_unqiue_;
+					item.last_unique    = packet_unique;
 				}
 
 				if (conf_.hv_bucket_count > 0)
@@ -274,17 +274,29 @@ namespace { namespace aux {
 
 		public:
 
-			aggregator_t(pinba_globals_t *globals, report_conf___by_timer_t const& conf, report_info_t const& rinfo)
+			aggregator_t(pinba_globals_t *globals, report_conf___by_timer_t const& conf, report_info_t const& rinfo, tick_pool_ptr tick_pool)
 				: globals_(globals)
 				, stats_(nullptr)
 				, conf_(conf)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
 				, packet_unqiue_(1) // init this to 1, so it's different from 0 in default constructed data_t
-				, tick_(meow::make_intrusive<tick_t>())
+				, tick_pool_(std::move(tick_pool))
+				, tick_(tick_pool_->get())
 			{
 				// key info
 				ki_.from_config(conf);
 
+				// timer tag names to match, filters first, then key parts (see match_timer_tags in collect_packet_timers())
+				{
+					for (auto const& ttf : conf_.timertag_filters)
+						timertag_needles_.push_back(ttf.name_id);
+
+					for (auto const& d : ki_.timer_tag_r)
+						timertag_needles_.push_back(d.d.timer_tag);
+
+					timertag_seen_.resize(timertag_needles_.size, 0);
+				}
+
 				// bloom
 				{
 					for (auto const& kd : conf_.keys)
@@ -301,6 +313,20 @@ namespace { namespace aux {
 						packet_bloom_.add(ttf.name_id);
 						timer_bloom_.add(ttf.name_id);
 					}
+
+					for (auto const& kd : conf_.keys)
+					{
+						if (RKD_REQUEST_TAG != kd.kind)
+							continue;
+
+						rtag_bloom_.add(kd.request_tag);
+					}
+
+					for (auto const& filter : conf_.filters)
+					{
+						if (filter.rtag_name_id != 0)
+							rtag_bloom_.add(filter.rtag_name_id);
+					}
 				}
 			}
 
@@ -311,8 +337,13 @@ namespace { namespace aux {
 
 			virtual report_tick_ptr tick_now(timeval_t curr_tv) override
 			{
+				size_t const prev_row_count = tick_->ht.size();
+
 				report_tick_ptr result = std::move(tick_);
-				tick_ = meow::make_intrusive<tick_t>();
+				tick_ = tick_pool_->get();
+
+				// avoid rehashing all the way up from empty during the tick
+				report_hashtable___presize(tick_->ht, prev_row_count);
 
 				return result;
 			}
@@ -337,7 +368,10 @@ namespace { namespace aux {
 				return result;
 			}
 
-			virtual void add(packet_t *packet) override
+			// run all packet and timer checks, and call sink(key, timer) for each timer to be aggregated
+			// stats are updated here, sink is expected to just record/apply the increment
+			template<class SinkT>
+			void collect_packet_timers(packet_t *packet, SinkT const& sink)
 			{
 				// packet-level bloom check
 				// FIXME: this probably immediately causes L1/L2 miss, since bloom is at the end of packet struct ?
@@ -348,6 +382,13 @@ namespace { namespace aux {
 					return;
 				}
 
+				// same for request tags, needed by keys and filters
+				if (!packet->rtag_bloom.contains(this->rtag_bloom_))
+				{
+					stats_->packets_dropped_by_rtag_bloom++;
+					return;
+				}
+
 				// run all filters and check if packet is 'interesting to us'
 				for (size_t i = 0, i_end = conf_.filters.size(); i < i_end; ++i)
 				{
@@ -359,82 +400,68 @@ namespace { namespace aux {
 					}
 				}
 
-				// check if timer is interesting (aka satisfies filters)
-				auto const filter_by_timer_tags = [&](packed_timer_t const *t) -> bool
-				{
-					for (auto const& tfd : conf_.timertag_filters)
-					{
-						bool tag_exists = false;
-
-						for (uint32_t tag_i = 0; tag_i < t->tag_count; ++tag_i)
-						{
-							if (t->tag_name_ids[tag_i] != tfd.name_id)
-								continue;
+				// check if timer is interesting (aka satisfies filters) and put timer tag values into out_key
+				// single pass over timer tags, matching them against all names we need at once (see timertag_needles_)
+				//  - all tags with filtered name must have required value, and there must be at least one
+				//  - first tag with key part name gives key part value, each key tag must be present
+				// all key parts are written straight to their final positions (descriptor_t::remap_to)
+				// so the key is ready to use as soon as timer tags are fetched, no remapping needed
+				enum : int { timer_ok, timer_filtered, timer_no_key };
 
-							tag_exists = true;
+				uint32_t const n_filters  = conf_.timertag_filters.size();
+				uint32_t const n_key_tags = ki_.timer_tag_count();
 
-							if (t->tag_value_ids[tag_i] != tfd.value_id)
-								return false;
-						}
-
-						if (!tag_exists)
-							return false;
-					}
-					return true;
-				};
-
-				// put key data into out_range if timer has all the parts
-				auto const fetch_by_timer_tags = [&](key_info_t const& ki, key_subrange_t out_range, packed_timer_t const *t) -> bool
+				auto const match_timer_tags = [&](key_t *out_key, packed_timer_t const *t) -> int
 				{
-					uint32_t const n_tags_required = out_range.size();
+					std::fill(timertag_seen_.begin(), timertag_seen_.end(), 0);
+
+					uint32_t n_filters_seen = 0;
+					uint32_t n_keys_seen    = 0;
+					bool     filter_failed  = false;
 
-					for (uint32_t i = 0; i < n_tags_required; ++i)
+					pinba::find_u32_multi(t->tag_name_ids, t->tag_count, timertag_needles_, [&](uint32_t tag_i, uint32_t needle_i) -> bool
 					{
-						bool tag_found = false;
+						bool const first_seen = (timertag_seen_[needle_i] == 0);
+						timertag_seen_[needle_i] = 1;
 
-						for (uint32_t tag_i = 0; tag_i < t->tag_count; ++tag_i)
+						if (needle_i < n_filters)
 						{
-							if (t->tag_name_ids[tag_i] != ki.timer_tag_r[i].d.timer_tag)
-								continue;
+							n_filters_seen += first_seen;
 
-							out_range[i] = t->tag_value_ids[tag_i];
-							tag_found = true;
-							break;
+							filter_failed = (t->tag_value_ids[tag_i] != conf_.timertag_filters[needle_i].value_id);
+							return !filter_failed;
 						}
 
-						// each full run of inner loop - must get us a tag
-						// so if it didn't -> just return false
-						if (!tag_found)
-							return false;
-					}
+						if (first_seen)
+						{
+							(*out_key)[ki_.timer_tag_r[needle_i - n_filters].remap_to] = t->tag_value_ids[tag_i];
+							n_keys_seen++;
+						}
 
-					return true;
+						// nothing more to check, once all key parts are there
+						return (n_filters > 0) || (n_keys_seen < n_key_tags);
+					});
+
+					if (filter_failed || (n_filters_seen < n_filters))
+						return timer_filtered;
+
+					if (n_keys_seen < n_key_tags)
+						return timer_no_key;
+
+					return timer_ok;
 				};
 
 				auto const find_request_tags = [&](key_info_t const& ki, key_t *out_key) -> bool
 				{
-					key_subrange_t out_range = ki_.rtag_key_subrange(*out_key);
-
-					uint32_t const n_tags_required = out_range.size();
-
-					for (uint32_t tag_i = 0; tag_i < n_tags_required; ++tag_i)
+					for (auto const& d : ki.request_tag_r)
 					{
-						bool tag_found = false;
+						uint32_t const *tag_value = packet___find_request_tag(packet, d.d.request_tag);
 
-						for (uint16_t i = 0, i_end = packet->tag_count; i < i_end; ++i)
-						{
-							if (packet->tag_name_ids[i] != ki.request_tag_r[tag_i].d.request_tag)
-								continue;
-
-							out_range[tag_i] = packet->tag_value_ids[i];
-							tag_found = true;
-							break;
-						}
-
-						// each full run of inner loop - must get us a tag
-						// so if it didn't -> just return false
-						if (!tag_found)
+						// each required tag must be present
+						if (tag_value == nullptr)
 							return false;
+
+						(*out_key)[d.remap_to] = *tag_value;
 					}
 
 					return true;
@@ -442,14 +469,13 @@ namespace { namespace aux {
 
 				auto const find_request_fields = [&](key_info_t const& ki, key_t *out_key) -> bool
 				{
-					key_subrange_t out_range = ki_.rfield_key_subrange(*out_key);
-
-					for (uint32_t i = 0; i < ki.request_field_r.size(); ++i)
+					for (auto const& d : ki.request_field_r)
 					{
-						out_range[i] = packet->*ki.request_field_r[i].d.request_field;
-
-						if (out_range[i] == 0)
+						uint32_t const value = packet->*d.d.request_field;
+						if (value == 0)
 							return false;
+
+						(*out_key)[d.remap_to] = value;
 					}
 
 					return true;
@@ -457,18 +483,24 @@ namespace { namespace aux {
 
 				key_t key_inprogress;
 
-				bool const tags_found = find_request_tags(ki_, &key_inprogress);
-				if (!tags_found)
+				if (has_request_tags)
 				{
-					stats_->packets_dropped_by_rtag++;
-					return;
+					bool const tags_found = find_request_tags(ki_, &key_inprogress);
+					if (!tags_found)
+					{
+						stats_->packets_dropped_by_rtag++;
+						return;
+					}
 				}
 
-				bool const fields_found = find_request_fields(ki_, &key_inprogress);
-				if (!fields_found)
+				if (has_request_fields)
 				{
-					stats_->packets_dropped_by_rfield++;
-					return;
+					bool const fields_found = find_request_fields(ki_, &key_inprogress);
+					if (!fields_found)
+					{
+						stats_->packets_dropped_by_rfield++;
+						return;
+					}
 				}
 
 				// need to scan all timers, find matching and increment for each one
@@ -481,8 +513,6 @@ namespace { namespace aux {
 				{
 					packet_unqiue_++; // next unique, since this is the new packet add
 
-					key_subrange_t const timer_key_range = ki_.timertag_key_subrange(key_inprogress);
-
 					for (uint16_t i = 0; i < packet->timer_count; ++i)
 					{
 						timer_bloom_t const *tbloom = &packet->timers_blooms[i];
@@ -497,14 +527,13 @@ namespace { namespace aux {
 							continue;
 						}
 
-						bool const timer_ok = filter_by_timer_tags(timer);
-						if (!timer_ok) {
+						int const timer_match = match_timer_tags(&key_inprogress, timer);
+						if (timer_match == timer_filtered) {
 							timers_skipped_by_filters++;
 							continue;
 						}
 
-						bool const timer_found = fetch_by_timer_tags(ki_, timer_key_range, timer);
-						if (!timer_found) {
+						if (timer_match == timer_no_key) {
 							timers_skipped_by_tags++;
 							continue;
 						}
@@ -513,14 +542,7 @@ namespace { namespace aux {
 
 						// LOG_DEBUG(globals_->logger(), "found key '{0}'", key_to_string(key_inprogress));
 
-						// key_t const k = ki_.remap_key(key_inprogress);
-						key_t k = {};
-						ki_.remap_key_to_from(k, key_inprogress);
-
-						// LOG_DEBUG(globals_->logger(), "remapped key '{0}'", key_to_string(k));
-
-						// finally - find and update item
-						this->raw_item_increment(k, packet, timer);
+						sink(key_inprogress, timer);
 					}
 				}
 
@@ -536,10 +558,57 @@ namespace { namespace aux {
 					stats_->packets_aggregated++;
 			}
 
+			virtual void add(packet_t *packet) override
+			{
+				this->collect_packet_timers(packet, [this](key_t const& k, packed_timer_t const *timer)
+				{
+					uint64_t const key_hash = report_key_impl___hasher_t()(k);
+
+					// find and update item
+					tick_item_t& item = this->raw_item_reference(k, key_hash);
+					this->raw_item_increment(item, timer, packet_unqiue_);
+				});
+			}
+
+			// batch version of add(), staged to hide memory latency on reports with lots of rows
+			//  1. run checks and extract keys + hashes for a chunk of packets
+			//  2. prefetch hashtable buckets for all keys
+			//  3. find/create items, prefetching each one
+			//  4. apply increments
 			virtual void add_multi(packet_t **packets, uint32_t packet_count) override
 			{
-				for (uint32_t i = 0; i < packet_count; ++i)
-					this->add(packets[i]);
+				for (uint32_t chunk_begin = 0; chunk_begin < packet_count; chunk_begin += packets_per_chunk)
+				{
+					uint32_t const chunk_end = std::min(packet_count, chunk_begin + packets_per_chunk);
+
+					batch_.clear();
+
+					for (uint32_t i = chunk_begin; i < chunk_end; ++i)
+					{
+						this->collect_packet_timers(packets[i], [this](key_t const& k, packed_timer_t const *timer)
+						{
+							batch_.push_back(batch_item_t {
+								.key           = k,
+								.key_hash      = report_key_impl___hasher_t()(k),
+								.packet_unique = packet_unqiue_,
+								.timer         = timer,
+								.item          = nullptr,
+							});
+						});
+					}
+
+					for (auto const& bi : batch_)
+						tick_->ht.prefetch_hash(bi.key_hash);
+
+					for (auto& bi : batch_)
+					{
+						bi.item = &this->raw_item_reference(bi.key, bi.key_hash);
+						__builtin_prefetch(bi.item, 1);
+					}
+
+					for (auto const& bi : batch_)
+						this->raw_item_increment(*bi.item, bi.timer, bi.packet_unique);
+				}
 			}
 
 		private:
@@ -550,11 +619,29 @@ namespace { namespace aux {
 
 			uint64_t                     packet_unqiue_;
 
+			// add_multi() staging area, reused between batches
+			struct batch_item_t
+			{
+				key_t                 key;
+				uint64_t              key_hash;
+				uint64_t              packet_unique;
+				packed_timer_t const  *timer;
+				tick_item_t           *item;
+			};
+
+			static constexpr uint32_t packets_per_chunk = 16;
+			std::vector<batch_item_t>    batch_;
+
 			key_info_t                   ki_;
 
+			pinba::find_u32_needles_t    timertag_needles_;
+			std::vector<uint8_t>         timertag_seen_;    // per needle, scratch space for collect_packet_timers()
+
 			timertag_bloom_t             packet_bloom_;
 			timer_bloom_t                timer_bloom_;
+			requesttag_bloom_t           rtag_bloom_;
 
+			tick_pool_ptr                tick_pool_;
 			boost::intrusive_ptr<tick_t> tick_;
 		};
 
@@ -562,15 +649,16 @@ namespace { namespace aux {
 
 		struct history_t : public report_history_t
 		{
-			using ring_t       = report_history_ringbuffer_t;
+			using ring_t       = report_history_tiers_t;
 			using ringbuffer_t = ring_t::ringbuffer_t;
 
 			struct history_row_t
 			{
-				uint64_t          key_hash;
-				key_t             key;
-				data_t            data;
-				flat_histogram_t  hv;
+				uint64_t            key_hash;
+				key_t               key;
+				data_t              data;
+				packed_histogram_t  hv;       // in tick hv_arena
+				uint32_t            n_ticks;  // original ticks folded into this row, 1 unless this is a rollup tick
 			};
 
 			struct history_tick_t : public report_tick_t // not required to inherit here, but get history ring for free
@@ -578,17 +666,55 @@ namespace { namespace aux {
 				// precalculated mem usage, to avoid expensive computation in get_estimates()
 				uint64_t                   mem_used = 0;
 
-				std::vector<history_row_t> rows    = {};
+				std::vector<history_row_t> rows     = {};
+				packed_histogram_arena_t   hv_arena = {};
 			};
 
+			// all ticks in the ring, merged (see report_history_window_t)
+			struct window_traits_t
+			{
+				using key_t  = typename report___by_timer_t::key_t;
+				using data_t = typename report___by_timer_t::data_t;
+				using tick_t = history_tick_t;
+
+				static size_t                    row_count(tick_t const& tick)              { return tick.rows.size(); }
+				static uint64_t                  row_key_hash(tick_t const& tick, size_t i) { return tick.rows[i].key_hash; }
+				static key_t const&              row_key(tick_t const& tick, size_t i)      { return tick.rows[i].key; }
+				static data_t const&             row_data(tick_t const& tick, size_t i)     { return tick.rows[i].data; }
+				static packed_histogram_t const& row_hv(tick_t const& tick, size_t i)       { return tick.rows[i].hv; }
+				static uint32_t                  row_n_ticks(tick_t const& tick, size_t i)  { return tick.rows[i].n_ticks; }
+
+				static void data_add(data_t *to, data_t const& from)
+				{
+					to->req_count  += from.req_count;
+					to->hit_count  += from.hit_count;
+					to->time_total += from.time_total;
+					to->ru_utime   += from.ru_utime;
+					to->ru_stime   += from.ru_stime;
+				}
+
+				static void data_subtract(data_t *to, data_t const& from)
+				{
+					to->req_count  -= from.req_count;
+					to->hit_count  -= from.hit_count;
+					to->time_total -= from.time_total;
+					to->ru_utime   -= from.ru_utime;
+					to->ru_stime   -= from.ru_stime;
+				}
+			};
+
+			using window_t = report_history_window_t<window_traits_t>;
+
 		public:
 
-			history_t(pinba_globals_t *globals, report_info_t const& rinfo)
+			history_t(pinba_globals_t *globals, report_info_t const& rinfo, tick_pool_ptr tick_pool)
 				: globals_(globals)
 				, stats_(nullptr)
 				, rinfo_(rinfo)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
+				, tick_pool_(std::move(tick_pool))
 				, ring_(rinfo.tick_count)
+				, window_(rinfo.hv_enabled)
 			{
 			}
 
@@ -600,7 +726,7 @@ namespace { namespace aux {
 			virtual void merge_tick(report_tick_ptr tick_base) override
 			{
 				// re-process tick data, for more compact storage
-				auto *agg_tick = static_cast<tick_t const*>(tick_base.get()); // src (non-const to move from, see below)
+				auto *agg_tick = static_cast<tick_t*>(tick_base.get());       // src (non-const to move from, see below)
 				auto    h_tick = meow::make_intrusive<history_tick_t>();      // dst
 
 				// remember to grab repacker_state
@@ -621,48 +747,43 @@ namespace { namespace aux {
 					dst_row.key_hash = src_item.key_hash;
 					dst_row.key      = src_key;
 					dst_row.data     = src_item.data;
+					dst_row.hv       = {};
+					dst_row.n_ticks  = 1;
 
-					// FIXME: only convert if histograms are enabled!
-					dst_row.hv       = std::move(histogram___convert_hdr_to_flat(src_item.hv, hv_conf_));
-					h_tick->mem_used += dst_row.hv.values.capacity() * sizeof(*dst_row.hv.values.begin());
+					if (HISTOGRAM_KIND__SKETCH == rinfo_.hv_kind)
+						dst_row.hv = histogram___pack_hdr_as_sketch(&h_tick->hv_arena, src_item.hv, hv_conf_);
+					else if (rinfo_.hv_enabled)
+						dst_row.hv = histogram___pack_hdr(&h_tick->hv_arena, src_item.hv, hv_conf_);
 				}
 
-				ring_.append(std::move(h_tick));
-			}
+				h_tick->hv_arena.shrink_to_fit();
+				h_tick->mem_used += h_tick->hv_arena.capacity();
 
-			virtual report_estimates_t get_estimates() override
-			{
-				report_estimates_t result = {};
+				// converted, give it back to aggregator for reuse
+				tick_pool_->put(std::move(tick_base));
 
-				result.row_count = [&]() -> uint32_t
-				{
-					auto const& ringbuf = ring_.get_ringbuffer();
-					if (ringbuf.empty())
-						return 0;
+				auto const new_tick_ref = h_tick; // keep alive until merged into window, ring might fold it away
+				history_tick_t const& new_tick = *new_tick_ref;
 
-					uint32_t non_unique_rows = 0;
+				report_tick_ptr evicted = ring_.append(std::move(h_tick), [this](report_tick_ptr const *ticks, uint32_t n_ticks)
+				{
+					return this->rollup_ticks(ticks, n_ticks);
+				});
+				auto const *evicted_tick = static_cast<history_tick_t const*>(evicted.get());
 
-					for (auto const& tick_base : ringbuf)
-					{
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-						non_unique_rows += tick.rows.size();
-					}
+				// evicted tick is still alive, we're holding a ref
+				window_.merge_tick(new_tick, evicted_tick, globals_->options()->report_merge_threads);
+			}
 
-					// got stats from snapshot merge with exact values, adjust based uniq to total rows ratio
-					if (stats_->last_snapshot_src_rows && stats_->last_snapshot_uniq_rows)
-					{
-						double const uniq_to_raw_fraction = (double)stats_->last_snapshot_uniq_rows / stats_->last_snapshot_src_rows;
-						return non_unique_rows * uniq_to_raw_fraction;
-					}
+			virtual report_estimates_t get_estimates() override
+			{
+				report_estimates_t result = {};
 
-					// no stats from snapshot merge yet,
-					// use average tick size (aka lean low and assume, all values repeat every tick)
-					return (uint32_t)std::ceil((double)non_unique_rows / ringbuf.size());
-				}();
+				result.row_count = window_.row_count();
 
 				result.mem_used += sizeof(*this);
 
-				for (auto const& tick_base : ring_.get_ringbuffer())
+				for (auto const& tick_base : ring_.get_view())
 				{
 					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
 
@@ -670,131 +791,85 @@ namespace { namespace aux {
 					result.mem_used += tick.mem_used;
 				}
 
+				result.mem_used += window_.mem_used();
+
 				return result;
 			}
 
-		public: // snapshot
+		private: // history tiers
 
-			struct snapshot_traits
+			// merge several history ticks into one, for older parts of long histories (see report_history_tiers_t)
+			// window is not touched, as rollup is just a sum of ticks already there
+			// rollup rows remember how many original ticks they cover, so that window takes them all out at once on eviction
+			report_tick_ptr rollup_ticks(report_tick_ptr const *ticks, uint32_t n_ticks)
 			{
-				using src_ticks_t = ringbuffer_t;
-				using totals_t    = report_row_data___by_timer_t;
-
-				struct row_t
-				{
-					data_t       data;
-
-					// list of saved hvs, we merge only when requested (i.e. in hv_at_position)
-					// please note that we're also saving pointers to flat_histogram_t::values
-					// and will restore full structs on merge
-					// this a 'limitation' of multi_merge() function
-					std::vector<histogram_values_t const*>  saved_hv;
-					flat_histogram_t                        merged_hv;
-				};
+				auto r_tick = meow::make_intrusive<history_tick_t>();
 
-				struct hashtable_t
-					: public tsl::robin_map<
+				using index_t = tsl::robin_map<
 									  key_t
-									, row_t
+									, uint32_t
 									, report_key_impl___hasher_t
 									, report_key_impl___equal_t
-									, std::allocator<std::pair<key_t, row_t>>
-									, /*StoreHash=*/ true>
-				{
-				};
+									, std::allocator<std::pair<key_t, uint32_t>>
+									, /*StoreHash=*/ true>;
+				index_t index;
 
-			public:
-
-				static report_key_t key_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
-				{
-					return report_key_t { it->first };
-				}
-
-				static void* value_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
-				{
-					return (void*)&it->second.data;
-				}
+				// histograms are collected per row, merged all at once and packed into rollup tick arena at the end
+				packed_histogram_rollup_t hv_rollup;
 
-				static void* hv_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
+				for (uint32_t i = 0; i < n_ticks; i++)
 				{
-					row_t *row = const_cast<row_t*>(&it->second); // will mutate the row, potentially
+					auto const& src_tick = static_cast<history_tick_t const&>(*ticks[i]);
 
-					if (row->saved_hv.empty()) // already merged
-						return &row->merged_hv;
+					repacker_state___merge_to_from(r_tick->repacker_state, src_tick.repacker_state);
 
-					struct merger_t
+					for (auto const& src : src_tick.rows)
 					{
-						flat_histogram_t *to;
+						auto const inserted_pair = index.emplace_hash(src.key_hash, src.key, (uint32_t)r_tick->rows.size());
+						uint32_t const dst_offset = inserted_pair.first->second;
 
-						inline bool compare(histogram_value_t const& l, histogram_value_t const& r) const
-						{
-							return l.bucket_id < r.bucket_id;
-						}
+						if (rinfo_.hv_enabled)
+							hv_rollup.add(dst_offset, src_tick.hv_arena, src.hv);
 
-						inline bool equal(histogram_value_t const& l, histogram_value_t const& r) const
+						if (inserted_pair.second)
 						{
-							return l.bucket_id == r.bucket_id;
+							r_tick->rows.push_back(src);
+							continue;
 						}
 
-						inline void reserve(size_t const sz)
-						{
-							to->values.reserve(sz);
-						}
+						history_row_t& dst = r_tick->rows[dst_offset];
 
-						inline void push_back(histogram_values_t const *seq, histogram_value_t const& v)
-						{
-							flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, seq);
-
-							bool const should_insert = [&]()
-							{
-								if (to->values.empty())
-									return true;
-
-								return !equal(to->values.back(), v);
-							}();
-
-							if (should_insert)
-							{
-								to->values.emplace_back(v);
-							}
-							else
-							{
-								to->values.back().value += v.value;
-							}
-						}
-					};
+						dst.n_ticks += src.n_ticks;
+						window_traits_t::data_add(&dst.data, src.data);
+					}
+				}
 
-					// merge histogram values
-					merger_t merger = { .to = &row->merged_hv };
-					pinba::multi_merge(&merger, row->saved_hv.begin(), row->saved_hv.end());
+				r_tick->rows.shrink_to_fit();
 
-					// merge histogram totals
-					for (auto const *src_hv_values : row->saved_hv)
+				if (rinfo_.hv_enabled)
+				{
+					hv_rollup.merge((uint32_t)r_tick->rows.size(), [&](uint32_t row, flat_histogram_t const& hv)
 					{
-						flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, src_hv_values);
-						row->merged_hv.total_count  += src->total_count;
-						row->merged_hv.negative_inf += src->negative_inf;
-						row->merged_hv.positive_inf += src->positive_inf;
-					}
-
-					// clear source
-					row->saved_hv.clear();
+						r_tick->rows[row].hv = histogram___pack_flat(&r_tick->hv_arena, hv);
+					});
 
-					return &row->merged_hv;
+					r_tick->hv_arena.shrink_to_fit();
 				}
 
-				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
-				{
-					for (auto const& tick_base : ticks)
-					{
-						if (!tick_base)
-							continue;
+				r_tick->mem_used += r_tick->rows.capacity() * sizeof(*r_tick->rows.begin());
+				r_tick->mem_used += r_tick->hv_arena.capacity();
 
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+				return r_tick;
+			}
 
-						stats->row_count += tick.rows.size();
-					}
-				}
+		public: // snapshot
+
+			struct snapshot_traits : public report_history_window___snapshot_traits_t<window_t>
+			{
+				using src_ticks_t = ring_t::view_t;
+				using totals_t    = report_row_data___by_timer_t;
+
+				using hashtable_t = typename report_history_window___snapshot_traits_t<window_t>::hashtable_t;
 
 				static void calculate_totals(report_snapshot_ctx_t *snapshot_ctx, hashtable_t const& data, totals_t *totals)
 				{
@@ -809,81 +884,6 @@ namespace { namespace aux {
 						totals->ru_stime   += row.ru_stime;
 					}
 				}
-
-				// merge from src ringbuffer to snapshot data
-				static void merge_ticks_into_data(
-					  report_snapshot_ctx_t *snapshot_ctx
-					, src_ticks_t& ticks
-					, hashtable_t& to
-					, report_snapshot_t::merge_flags_t flags)
-				{
-					bool const need_histograms = (snapshot_ctx->rinfo.hv_enabled && (flags & report_snapshot_t::merge_flags::with_histograms));
-
-					// if we have result count estimate - try reserve the space in resulting hashtable
-					// this might get ugly, if we under-guess just slightly
-					// and face a giant rehash at the end of the merge
-					// but should save us some significant time on initial few rehashes
-					if (snapshot_ctx->estimates.row_count > 0)
-					{
-						to.reserve(snapshot_ctx->estimates.row_count);
-					}
-
-					uint64_t n_ticks = 0;
-					uint64_t key_lookups = 0;
-					uint64_t hv_appends = 0;
-
-					for (auto const& tick_base : ticks)
-					{
-						if (!tick_base)
-							continue;
-
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-
-						n_ticks++;
-
-						for (size_t i = 0; i < tick.rows.size(); i++)
-						{
-							history_row_t const& src = tick.rows[i];
-
-							auto inserted_pair = to.emplace_hash(src.key_hash, src.key, row_t{});
-							row_t&         dst = inserted_pair.first.value();
-
-							dst.data.req_count  += src.data.req_count;
-							dst.data.hit_count  += src.data.hit_count;
-							dst.data.time_total += src.data.time_total;
-							dst.data.ru_utime   += src.data.ru_utime;
-							dst.data.ru_stime   += src.data.ru_stime;
-
-							if (need_histograms)
-							{
-								flat_histogram_t const& src_hv = src.hv;
-
-								// try preallocate
-								if (dst.saved_hv.empty())
-									dst.saved_hv.reserve(ticks.size());
-
-								dst.saved_hv.push_back(&src_hv.values);
-							}
-						}
-
-						key_lookups += tick.rows.size();
-
-						if (need_histograms)
-							hv_appends  += tick.rows.size();
-					}
-
-					LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, key_lookups: {2}, hv_appends: {3}",
-						snapshot_ctx->rinfo.name, n_ticks, key_lookups, hv_appends);
-
-					// can clean ticks only if histograms were not merged
-					// since histogram merger uses raw pointers to tick_data_t::hvs[]::values
-					// and those need to be alive while this snapshot is alive
-					if (!need_histograms)
-					{
-						ticks.clear();
-						ticks.shrink_to_fit();
-					}
-				}
 			};
 
 			virtual report_snapshot_ptr get_snapshot() override
@@ -898,7 +898,7 @@ namespace { namespace aux {
 				};
 
 				using snapshot_t = report_snapshot__impl_t<snapshot_traits>;
-				return meow::make_unique<snapshot_t>(sctx, ring_.get_ringbuffer());
+				return meow::make_unique<snapshot_t>(sctx, ring_.get_view(), window_.get_view());
 			}
 
 		private:
@@ -906,8 +906,11 @@ namespace { namespace aux {
 			report_stats_t               *stats_;
 			report_info_t                rinfo_;
 			histogram_conf_t             hv_conf_;
+			tick_pool_ptr                tick_pool_;
 
-			report_history_ringbuffer_t  ring_;
+			report_history_tiers_t       ring_;
+
+			window_t                     window_;
 		};
 
 	public: // report_t
@@ -916,6 +919,7 @@ namespace { namespace aux {
 			: globals_(globals)
 			, stats_(nullptr)
 			, conf_(conf)
+			, tick_pool_(std::make_shared<tick_pool_t>())
 		{
 			assert(conf_.keys.size() == NKeys);
 
@@ -926,10 +930,15 @@ namespace { namespace aux {
 				.tick_count      = conf_.tick_count,
 				.n_key_parts     = (uint32_t)conf_.keys.size(),
 				.hv_enabled      = (conf_.hv_bucket_count > 0),
-				.hv_kind         = HISTOGRAM_KIND__FLAT,
+				.hv_kind         = (conf_.hv_sketch_alpha > 0) ? HISTOGRAM_KIND__SKETCH : HISTOGRAM_KIND__FLAT,
 				.hv_bucket_count = conf_.hv_bucket_count,
 				.hv_bucket_d     = conf_.hv_bucket_d,
 				.hv_min_value    = conf_.hv_min_value,
+				.hv_unit_size    = conf_.hv_unit_size,
+				.hv_precision_bits = conf_.hv_precision_bits,
+				.hv_sketch_alpha = conf_.hv_sketch_alpha,
+
+				.background_snapshot = conf_.background_snapshot,
 			};
 		}
 
@@ -945,12 +954,12 @@ namespace { namespace aux {
 
 		virtual report_agg_ptr create_aggregator() override
 		{
-			return std::make_shared<aggregator_t>(globals_, conf_, rinfo_);
+			return std::make_shared<aggregator_t>(globals_, conf_, rinfo_, tick_pool_);
 		}
 
 		virtual report_history_ptr create_history() override
 		{
-			return std::make_shared<history_t>(globals_, rinfo_);
+			return std::make_shared<history_t>(globals_, rinfo_, tick_pool_);
 		}
 
 	private:
@@ -959,8 +968,29 @@ namespace { namespace aux {
 		report_info_t             rinfo_;
 
 		report_conf___by_timer_t  conf_;
+		tick_pool_ptr             tick_pool_; // shared between aggregators and history
 	};
 
+	template<size_t NKeys>
+	report_ptr create_report_by_timer___with_layout(pinba_globals_t *globals, report_conf___by_timer_t const& conf)
+	{
+		int const key_layout = key_layout_from_config(conf);
+
+		switch (key_layout)
+		{
+			case KEY_LAYOUT__TIMER_TAGS:
+				return std::make_shared<report___by_timer_t<NKeys, KEY_LAYOUT__TIMER_TAGS>>(globals, conf);
+
+			case KEY_LAYOUT__FIELDS_AND_TAGS:
+				return std::make_shared<report___by_timer_t<NKeys, KEY_LAYOUT__FIELDS_AND_TAGS>>(globals, conf);
+
+			case KEY_LAYOUT__GENERIC:
+				return std::make_shared<report___by_timer_t<NKeys, KEY_LAYOUT__GENERIC>>(globals, conf);
+		}
+
+		throw std::logic_error(ff::fmt_str("report_by_timer: unknown key layout {0}", key_layout));
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -978,7 +1008,7 @@ report_ptr create_report_by_timer(pinba_globals_t *globals, report_conf___by_tim
 			throw std::logic_error(ff::fmt_str("report_by_timer supports up to {0} keys, {1} given", max_keys, n_keys));
 
 	#define CASE(z, N, unused) \
-		case N: return std::make_shared<aux::report___by_timer_t<N>>(globals, conf); \
+		case N: return aux::create_report_by_timer___with_layout<N>(globals, conf); \
 	/**/
 
 	BOOST_PP_REPEAT_FROM_TO(1, BOOST_PP_ADD(PINBA_LIMIT___MAX_KEY_PARTS, 1), CASE, 0);
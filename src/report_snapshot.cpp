@@ -34,7 +34,7 @@ void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref
 			// 	}
 			// }
 			// else if (HISTOGRAM_KIND__FLAT == snapshot->histogram_kind())
-			if (HISTOGRAM_KIND__FLAT == snapshot->histogram_kind())
+			if (HISTOGRAM_KIND__FLAT == snapshot->histogram_kind() || HISTOGRAM_KIND__SKETCH == snapshot->histogram_kind())
 			{
 				auto const *hv = static_cast<flat_histogram_t const*>(histogram);
 
@@ -49,14 +49,11 @@ void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref
 				auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
 				bool printed_something = false;
 
-				for (uint32_t i = 0; i < hv->counts_len(); i++)
+				hv->for_each_nonzero([&](uint32_t index, uint32_t count)
 				{
-					if (hv->count_at_index(i) == 0)
-						continue;
-
-					ff::fmt(sink, "{0}{1}: {2}", (printed_something)?", ":"", hv->value_at_index(i), hv->count_at_index(i));
+					ff::fmt(sink, "{0}{1}: {2}", (printed_something)?", ":"", hv->value_at_index(index), count);
 					printed_something = true;
-				}
+				});
 
 				if (hv->negative_inf() > 0)
 				{
@@ -0,0 +1,157 @@
+#include <immintrin.h>
+
+#include "pinba/simd_histogram.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace pinba {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	uint32_t add_counts_u32___scalar(uint32_t *dst, uint32_t const *src, uint32_t size)
+	{
+		uint32_t n_new = 0;
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			n_new  += (dst[i] == 0) & (src[i] != 0);
+			dst[i] += src[i];
+		}
+		return n_new;
+	}
+
+	uint32_t add_counts_u32___sse4(uint32_t *dst, uint32_t const *src, uint32_t size)
+	{
+		__m128i const zero = _mm_setzero_si128();
+
+		uint32_t n_new = 0;
+		uint32_t i = 0;
+		for (; i + 4 <= size; i += 4)
+		{
+			__m128i const d = _mm_loadu_si128((__m128i const*)(dst + i));
+			__m128i const s = _mm_loadu_si128((__m128i const*)(src + i));
+
+			// lanes where dst is zero and src is not
+			__m128i const became_nonzero = _mm_andnot_si128(_mm_cmpeq_epi32(s, zero), _mm_cmpeq_epi32(d, zero));
+			n_new += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(became_nonzero)));
+
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(d, s));
+		}
+
+		return n_new + add_counts_u32___scalar(dst + i, src + i, size - i);
+	}
+
+	__attribute__((target("avx2")))
+	uint32_t add_counts_u32___avx2(uint32_t *dst, uint32_t const *src, uint32_t size)
+	{
+		__m256i const zero = _mm256_setzero_si256();
+
+		uint32_t n_new = 0;
+		uint32_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			__m256i const d = _mm256_loadu_si256((__m256i const*)(dst + i));
+			__m256i const s = _mm256_loadu_si256((__m256i const*)(src + i));
+
+			// lanes where dst is zero and src is not
+			__m256i const became_nonzero = _mm256_andnot_si256(_mm256_cmpeq_epi32(s, zero), _mm256_cmpeq_epi32(d, zero));
+			n_new += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(became_nonzero)));
+
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(d, s));
+		}
+
+		return n_new + add_counts_u32___sse4(dst + i, src + i, size - i);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	uint32_t find_nonzero_u32___scalar(uint32_t const *values, uint32_t size, uint32_t *positions)
+	{
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			// branchless compaction, position is always written, but only kept for nonzero values
+			positions[n] = i;
+			n += (values[i] != 0);
+		}
+		return n;
+	}
+
+	uint32_t find_nonzero_u32___sse4(uint32_t const *values, uint32_t size, uint32_t *positions)
+	{
+		__m128i const zero = _mm_setzero_si128();
+
+		uint32_t n = 0;
+		uint32_t i = 0;
+		for (; i + 4 <= size; i += 4)
+		{
+			__m128i const v = _mm_loadu_si128((__m128i const*)(values + i));
+			if (_mm_testz_si128(v, v))
+				continue;
+
+			uint32_t mask = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero))) & 0xf;
+			for (; mask != 0; mask &= mask - 1)
+				positions[n++] = i + __builtin_ctz(mask);
+		}
+
+		uint32_t const n_tail = find_nonzero_u32___scalar(values + i, size - i, positions + n);
+		for (uint32_t j = 0; j < n_tail; j++)
+			positions[n + j] += i;
+
+		return n + n_tail;
+	}
+
+	__attribute__((target("avx2")))
+	uint32_t find_nonzero_u32___avx2(uint32_t const *values, uint32_t size, uint32_t *positions)
+	{
+		__m256i const zero = _mm256_setzero_si256();
+
+		uint32_t n = 0;
+		uint32_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			__m256i const v0 = _mm256_loadu_si256((__m256i const*)(values + i));
+			__m256i const v1 = _mm256_loadu_si256((__m256i const*)(values + i + 8));
+			__m256i const v2 = _mm256_loadu_si256((__m256i const*)(values + i + 16));
+			__m256i const v3 = _mm256_loadu_si256((__m256i const*)(values + i + 24));
+
+			// most of the counts are zero, skip them in large chunks
+			__m256i const any = _mm256_or_si256(_mm256_or_si256(v0, v1), _mm256_or_si256(v2, v3));
+			if (_mm256_testz_si256(any, any))
+				continue;
+
+			uint64_t mask =
+				  ((uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v0, zero))))
+				| ((uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v1, zero))) << 8)
+				| ((uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v2, zero))) << 16)
+				| ((uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v3, zero))) << 24);
+			mask = ~mask & 0xffffffff;
+
+			for (; mask != 0; mask &= mask - 1)
+				positions[n++] = i + __builtin_ctzll(mask);
+		}
+
+		uint32_t const n_tail = find_nonzero_u32___sse4(values + i, size - i, positions + n);
+		for (uint32_t j = 0; j < n_tail; j++)
+			positions[n + j] += i;
+
+		return n + n_tail;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	simd_histogram_impl_t const& simd_histogram___best()
+	{
+		static simd_histogram_impl_t const impl = []() -> simd_histogram_impl_t
+		{
+			__builtin_cpu_init();
+
+			if (__builtin_cpu_supports("avx2"))
+				return { add_counts_u32___avx2, find_nonzero_u32___avx2 };
+
+			return { add_counts_u32___sse4, find_nonzero_u32___sse4 };
+		}();
+
+		return impl;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace pinba {
+////////////////////////////////////////////////////////////////////////////////////////////////
@@ -763,6 +763,10 @@ public:
         return insert_hash(hash, value_type(std::forward<Args>(args)...));
     }
 
+    void prefetch_hash(std::size_t hash) const noexcept {
+        __builtin_prefetch(static_cast<const void*>(m_buckets + bucket_for_hash(hash)));
+    }
+
 
 
     template<class K, class... Args>
@@ -323,6 +323,14 @@ public:
         return m_ht.emplace_hash(hash, std::forward<Args>(args)...);
     }
 
+    /**
+     * Prefetch the bucket that an element with given precalculated hash would be looked up in.
+     * Useful to hide memory latency when processing a batch of keys with hashes known in advance.
+     */
+    void prefetch_hash(std::size_t hash) const noexcept {
+        m_ht.prefetch_hash(hash);
+    }
+
 
 
     /**